@@ -0,0 +1,499 @@
+/*            PURPOSE : Benchmark of the renderer, stage by stage and end to end, without a window
+
+        PREREQUISITES : zkucera_CompSci_Assignment3.c, included whole with its entry points left out
+
+        Build with: cc -O2 -o benchmark benchmark.c -lm -lpthread
+
+*/
+
+/* Each benchmark is run a few times to warm the caches and the allocator,
+   then timed over a number of repeats. The median, 95th percentile, minimum
+   and mean times of one run are reported in milliseconds, as a table, CSV
+   or JSON, so that results can be compared across versions. Runs are
+   reproducible: the scene is fixed and the synthetic polygons come from a
+   seeded generator.
+
+     matrix.*     mat4 and dmatrix_t operations of matrix.h
+     camera.*     build_camera_matrix and build_frustum
+     generate.*   the parametric tessellation of each shape, at each density
+     shade        projecting and lighting every mesh, at each density and resolution
+     sort         the far to near depth sort of the painter's algorithm
+     fill.*       the scanline and span fillers, on synthetic polygons and on those of the scene
+     frame        a whole frame: tessellate, shade, sort and fill
+
+   Density scales the parametric steps of every shape of the scene, so 1 is
+   the tessellation of the assignment. */
+
+#define NO_MAIN
+#include "zkucera_CompSci_Assignment3.c"
+
+#define BENCH_MAX_REPEATS 1000
+#define BENCH_MAX_LIST 16
+#define BENCH_SYNTHETIC 20000 /* Synthetic polygons per fill run */
+#define BENCH_OPERANDS 8      /* mat4 operands the matrix.* loops cycle through, a power of 2 */
+
+enum { BENCH_TEXT, BENCH_CSV, BENCH_JSON } ;
+
+typedef void (*bench_fn_t)(void *arg) ;
+
+struct {
+  int warmup, repeats ;
+  int format ;
+  const char *only ;          /* Prefix of the benchmarks to run, or NULL for all */
+  FILE *out ;
+  int results ;               /* Rows written so far */
+  double times[BENCH_MAX_REPEATS] ;
+} bench = { 2, 10, BENCH_TEXT, NULL, NULL, 0 } ;
+
+
+/* One run of every benchmark works on this */
+
+struct {
+  scene_t scene ;             /* The scene at density 1 */
+  mesh_t meshes[SCENE_MAX_SHAPES] ;
+  polygon_buffer_t polygons ; /* The polygons of the scene, as shaded for the current camera */
+  polygon_buffer_t synthetic ;
+  framebuffer_t fb ;
+  int rejected[CULL_REASONS] ;
+  int shape ;                 /* The shape generate.* tessellates */
+  fill_polygon_t fill ;       /* The filler fill.* runs */
+  mat4_t A, B ;
+  mat4_t M[BENCH_OPERANDS], R[BENCH_OPERANDS] ; /* Fixed right hand operands and the products */
+  vec4_t P[BENCH_OPERANDS], Q[BENCH_OPERANDS] ;
+  dmatrix_t *D, *E ;          /* 4x4 dmatrix_t operands */
+  dmatrix_t *S, *T ;          /* A larger system for dmat_solve */
+} ctx ;
+
+
+int bench_compare(const void *a, const void *b) {
+
+  double x = *(const double *)a, y = *(const double *)b ;
+
+  return x < y ? -1 : x > y ;
+}
+
+
+/* Times fn(arg) and writes one row of results. prepare, if given, runs
+   before every run and is not timed. items is the work done by one run. */
+
+void bench_run(const char *name, double density, int w, int h, long items, bench_fn_t fn, bench_fn_t prepare, void *arg) {
+
+  double t, sum = 0.0, median, p95 ;
+  int i, n = bench.repeats ;
+
+  if (bench.only && strncmp(name,bench.only,strlen(bench.only)) != 0) {
+    return ;
+  }
+  for (i = 0 ; i < bench.warmup + n ; i++) {
+    size_t mark = dmat_arena_mark() ;
+
+    if (prepare) prepare(arg) ;
+    t = prof_now() ;
+    fn(arg) ;
+    t = prof_now() - t ;
+    dmat_arena_release(mark) ;
+    if (i >= bench.warmup) {
+      bench.times[i - bench.warmup] = 1000.0*t ;
+    }
+  }
+  qsort(bench.times,n,sizeof(double),bench_compare) ;
+  for (i = 0 ; i < n ; i++) {
+    sum += bench.times[i] ;
+  }
+  median = n%2 ? bench.times[n/2] : 0.5*(bench.times[n/2 - 1] + bench.times[n/2]) ;
+  p95 = bench.times[(int)ceil(0.95*n) - 1] ;
+
+  if (bench.format == BENCH_CSV) {
+    if (bench.results == 0) {
+      fprintf(bench.out,"name,density,width,height,items,repeats,median_ms,p95_ms,min_ms,mean_ms\n") ;
+    }
+    fprintf(bench.out,"%s,%g,%d,%d,%ld,%d,%.4f,%.4f,%.4f,%.4f\n",name,density,w,h,items,n,median,p95,bench.times[0],sum/n) ;
+  }
+  else if (bench.format == BENCH_JSON) {
+    fprintf(bench.out,"%s\n    {\"name\":\"%s\",\"density\":%g,\"width\":%d,\"height\":%d,\"items\":%ld,\"repeats\":%d,\"median_ms\":%.4f,\"p95_ms\":%.4f,\"min_ms\":%.4f,\"mean_ms\":%.4f}",
+            bench.results ? "," : "",name,density,w,h,items,n,median,p95,bench.times[0],sum/n) ;
+  }
+  else {
+    if (bench.results == 0) {
+      fprintf(bench.out,"%-28s %7s %11s %9s %11s %11s %11s %11s\n","name","density","resolution","items","median ms","p95 ms","min ms","mean ms") ;
+    }
+    fprintf(bench.out,"%-28s %7g %5dx%-5d %9ld %11.4f %11.4f %11.4f %11.4f\n",name,density,w,h,items,median,p95,bench.times[0],sum/n) ;
+  }
+  fflush(bench.out) ;
+  bench.results++ ;
+}
+
+
+/* The stages, each one run of a benchmark */
+
+#define MATRIX_OPS 100000
+
+/* The products go to R and Q rather than back into an operand, which would
+   grow without bound and time arithmetic on infinities and NaNs. */
+
+void bench_mat4_mult(void *arg) {
+
+  for (int i = 0 ; i < MATRIX_OPS ; i++) {
+    int k = i & (BENCH_OPERANDS - 1) ;
+
+    ctx.R[k] = mat4_mult(&ctx.B,&ctx.M[k]) ;
+  }
+}
+
+
+void bench_mat4_mult_vec4(void *arg) {
+
+  for (int i = 0 ; i < MATRIX_OPS ; i++) {
+    int k = i & (BENCH_OPERANDS - 1) ;
+
+    ctx.Q[k] = mat4_mult_vec4(&ctx.B,ctx.P[k]) ;
+  }
+}
+
+
+void bench_dmat_mult(void *arg) {
+
+  for (int i = 0 ; i < MATRIX_OPS/10 ; i++) {
+    size_t mark = dmat_arena_mark() ;
+
+    dmat_mult(ctx.D,ctx.E) ;
+    dmat_arena_release(mark) ;
+  }
+}
+
+
+void bench_dmat_inverse(void *arg) {
+
+  for (int i = 0 ; i < MATRIX_OPS/10 ; i++) {
+    size_t mark = dmat_arena_mark() ;
+
+    dmat_inverse(ctx.D) ;
+    dmat_arena_release(mark) ;
+  }
+}
+
+
+void bench_determinant(void *arg) {
+
+  double d = 0.0 ;
+
+  for (int i = 0 ; i < MATRIX_OPS/10 ; i++) {
+    size_t mark = dmat_arena_mark() ;
+
+    d += determinant(ctx.D) ;
+    dmat_arena_release(mark) ;
+  }
+  ctx.A.m[0][0] = d ;
+}
+
+
+void bench_dmat_solve(void *arg) {
+
+  for (int i = 0 ; i < 100 ; i++) {
+    size_t mark = dmat_arena_mark() ;
+
+    dmat_solve(ctx.S,ctx.T) ;
+    dmat_arena_release(mark) ;
+  }
+}
+
+
+void bench_camera(void *arg) {
+
+  frustum_t f ;
+
+  for (int i = 0 ; i < MATRIX_OPS/10 ; i++) {
+    ctx.A = build_camera_matrix(scene.E,scene.G) ;
+    f = build_frustum(scene.E,scene.G) ;
+  }
+  ctx.A.m[0][0] += f.plane[0].w ;
+}
+
+
+void bench_generate(void *arg) {
+
+  generateShapePoints(&ctx.meshes[ctx.shape],&scene.shape[ctx.shape]) ;
+}
+
+
+void bench_shade(void *arg) {
+
+  shadeScene(ctx.meshes,&ctx.polygons) ;
+}
+
+
+void bench_order(void *arg) {
+
+  pb_visible_order(&ctx.polygons,ctx.rejected) ;
+}
+
+
+void bench_sort(void *arg) {
+
+  pb_sort_far_to_near(&ctx.polygons) ;
+}
+
+
+void bench_clear(void *arg) {
+
+  fb_clear(&ctx.fb,FB_WHITE) ;
+}
+
+
+/* Fills the listed polygons of pb one after another with ctx.fill, as the
+   serial pass of fillScene does */
+
+void bench_fill(void *arg) {
+
+  polygon_buffer_t *pb = (polygon_buffer_t *)arg ;
+  vec4_t P[POLY_MAX_VERTICES] ;
+  int k, i, n ;
+
+  for (k = 0 ; k < pb->visible ; k++) {
+    i = pb->order[k] ;
+    n = pb_vertices(pb,i,P) ;
+    ctx.fill(&ctx.fb,pb_shade(pb,i),P,n) ;
+  }
+}
+
+
+void bench_frame(void *arg) {
+
+  for (int i = 0 ; i < scene.shapes ; i++) {
+    generateShapePoints(&ctx.meshes[i],&scene.shape[i]) ;
+  }
+  shadeScene(ctx.meshes,&ctx.polygons) ;
+  orderScene(&ctx.polygons,ctx.rejected) ;
+  fillScene(&ctx.fb,&ctx.polygons,ctx.rejected) ;
+}
+
+
+/* Repeatable pseudo-random numbers in [0,1), the same on every platform */
+
+unsigned int bench_seed ;
+
+double bench_random(void) {
+
+  bench_seed = bench_seed*1664525u + 1013904223u ;
+  return (bench_seed >> 8)/16777216.0 ;
+}
+
+
+/* BENCH_SYNTHETIC quads scattered over a w x h screen, each a square turned
+   by a random angle with sides from 1% to 5% of the width */
+
+void bench_synthetic(polygon_buffer_t *pb, int w, int h) {
+
+  vec4_t P[4], zero = vec4_make(0.0,0.0,0.0,0.0) ;
+  double x, y, r, a ;
+  int i, k ;
+
+  bench_seed = 12345u ;
+  pb_reserve(pb,BENCH_SYNTHETIC) ;
+  for (i = 0 ; i < BENCH_SYNTHETIC ; i++) {
+    x = w*bench_random() ;
+    y = h*bench_random() ;
+    r = w*(0.01 + 0.04*bench_random())*M_SQRT1_2 ;
+    a = 2.0*M_PI*bench_random() ;
+    for (k = 0 ; k < 4 ; k++) {
+      P[k] = vec4_make(x + r*cos(a + k*M_PI/2.0),y + r*sin(a + k*M_PI/2.0),0.5,1.0) ;
+    }
+    pb_store(pb,i,P,NULL,4,(float)i,zero,zero,FB_RGB(255*(i%3 == 0),255*(i%3 == 1),255*(i%3 == 2))) ;
+    pb->intensity[i] = 1.0f ;
+  }
+  pb->count = BENCH_SYNTHETIC ;
+  pb_visible_order(pb,ctx.rejected) ;
+}
+
+
+/* Reads a comma separated list of numbers, or of w x h sizes when h is given */
+
+int bench_list(const char *text, double v[], int h[]) {
+
+  int n = 0 ;
+  char *end ;
+
+  while (*text && n < BENCH_MAX_LIST) {
+    v[n] = strtod(text,&end) ;
+    if (end == text || v[n] <= 0.0) return 0 ;
+    if (h) {
+      if (*end != 'x') return 0 ;
+      text = end + 1 ;
+      h[n] = (int)strtol(text,&end,10) ;
+      if (end == text || h[n] < 1) return 0 ;
+    }
+    n++ ;
+    if (*end == ',') end++ ;
+    else if (*end) return 0 ;
+    text = end ;
+  }
+  return n ;
+}
+
+
+int main(int argc, char *argv[]) {
+
+  double densities[BENCH_MAX_LIST] = { 0.25, 0.5, 1.0 }, sizes[BENCH_MAX_LIST] = { 256, 512, 1024 } ;
+  int heights[BENCH_MAX_LIST] = { 256, 512, 1024 } ;
+  int ndensities = 3, nsizes = 3, threads = workers_cpu_count() ;
+  const char *output = NULL ;
+  char name[64] ;
+  int i, j, r, d, k ;
+
+  scene_default(&scene) ;
+  for (i = 1 ; i < argc ; i++) {
+    if (strcmp(argv[i],"-warmup") == 0 && i + 1 < argc) {
+      bench.warmup = atoi(argv[++i]) ;
+      if (bench.warmup < 0) bench.warmup = 0 ;
+    }
+    else if (strcmp(argv[i],"-repeats") == 0 && i + 1 < argc) {
+      bench.repeats = atoi(argv[++i]) ;
+      if (bench.repeats < 1 || bench.repeats > BENCH_MAX_REPEATS) {
+        fprintf(stderr,"The repeats must be from 1 to %d\n",BENCH_MAX_REPEATS) ;
+        return 1 ;
+      }
+    }
+    else if (strcmp(argv[i],"-densities") == 0 && i + 1 < argc) {
+      if (!(ndensities = bench_list(argv[++i],densities,NULL))) {
+        fprintf(stderr,"Densities are a list such as 0.25,0.5,1\n") ;
+        return 1 ;
+      }
+    }
+    else if (strcmp(argv[i],"-resolutions") == 0 && i + 1 < argc) {
+      if (!(nsizes = bench_list(argv[++i],sizes,heights))) {
+        fprintf(stderr,"Resolutions are a list such as 256x256,512x512\n") ;
+        return 1 ;
+      }
+    }
+    else if (strcmp(argv[i],"-threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]) ;
+      if (threads < 1) {
+        fprintf(stderr,"The thread count must be at least 1\n") ;
+        return 1 ;
+      }
+    }
+    else if (strcmp(argv[i],"-scene") == 0 && i + 1 < argc) {
+      if (!scene_load(&scene,argv[++i])) return 1 ;
+    }
+    else if (strcmp(argv[i],"-only") == 0 && i + 1 < argc) {
+      bench.only = argv[++i] ;
+    }
+    else if (strcmp(argv[i],"-format") == 0 && i + 1 < argc) {
+      i++ ;
+      if (strcmp(argv[i],"text") == 0) bench.format = BENCH_TEXT ;
+      else if (strcmp(argv[i],"csv") == 0) bench.format = BENCH_CSV ;
+      else if (strcmp(argv[i],"json") == 0) bench.format = BENCH_JSON ;
+      else {
+        fprintf(stderr,"Unknown format %s, expected text, csv or json\n",argv[i]) ;
+        return 1 ;
+      }
+    }
+    else if (strcmp(argv[i],"-o") == 0 && i + 1 < argc) {
+      output = argv[++i] ;
+    }
+    else {
+      fprintf(stderr,"usage: %s [-warmup n] [-repeats n] [-densities d,..] [-resolutions WxH,..] [-threads n] [-scene file] [-only prefix] [-format text|csv|json] [-o file]\n",argv[0]) ;
+      return 1 ;
+    }
+  }
+  bench.out = output ? fopen(output,"w") : stdout ;
+  if (!bench.out) {
+    fprintf(stderr,"Could not write %s\n",output) ;
+    return 1 ;
+  }
+
+  reportCounts = 0 ;
+  workers_start(threads) ;
+  dmat_arena_init(&frameArena,FRAME_ARENA_SIZE) ;
+  dmat_arena = &frameArena ;
+  ctx.scene = scene ;
+
+  if (bench.format == BENCH_JSON) {
+    fprintf(bench.out,"{\"threads\":%d,\"transform_width\":%d,\"warmup\":%d,\"repeats\":%d,\"results\":[",threads,TRANSFORM_WIDTH,bench.warmup,bench.repeats) ;
+  }
+
+  ctx.A = ctx.B = build_camera_matrix(scene.E,scene.G) ;
+  ctx.D = dmat_from_mat4(&ctx.B) ;
+  ctx.E = dmat_from_mat4(&ctx.B) ;
+  ctx.S = (dmatrix_t *)malloc(sizeof(dmatrix_t)) ;
+  ctx.T = (dmatrix_t *)malloc(sizeof(dmatrix_t)) ;
+  dmat_alloc(ctx.S,32,32) ;
+  dmat_alloc(ctx.T,32,1) ;
+  bench_seed = 1u ;
+  for (k = 0 ; k < BENCH_OPERANDS ; k++) {
+    for (i = 0 ; i < 4 ; i++) {
+      for (j = 0 ; j < 4 ; j++) {
+        ctx.M[k].m[i][j] = bench_random() ;
+      }
+    }
+    ctx.P[k] = vec4_make(bench_random(),bench_random(),bench_random(),1.0) ;
+  }
+  for (i = 1 ; i <= 32 ; i++) {
+    for (j = 1 ; j <= 32 ; j++) {
+      ctx.S->m[i][j] = bench_random() + (i == j ? 32.0 : 0.0) ; /* Diagonally dominant, so well conditioned */
+    }
+    ctx.T->m[i][1] = bench_random() ;
+  }
+  bench_run("matrix.mat4_mult",0,0,0,MATRIX_OPS,bench_mat4_mult,NULL,NULL) ;
+  bench_run("matrix.mat4_mult_vec4",0,0,0,MATRIX_OPS,bench_mat4_mult_vec4,NULL,NULL) ;
+  bench_run("matrix.dmat_mult_4x4",0,0,0,MATRIX_OPS/10,bench_dmat_mult,NULL,NULL) ;
+  bench_run("matrix.dmat_inverse_4x4",0,0,0,MATRIX_OPS/10,bench_dmat_inverse,NULL,NULL) ;
+  bench_run("matrix.determinant_4x4",0,0,0,MATRIX_OPS/10,bench_determinant,NULL,NULL) ;
+  bench_run("matrix.dmat_solve_32x32",0,0,0,100,bench_dmat_solve,NULL,NULL) ;
+  bench_run("camera.build_camera_matrix",0,0,0,MATRIX_OPS/10,bench_camera,NULL,NULL) ;
+
+  for (d = 0 ; d < ndensities ; d++) {
+    for (k = 0 ; k < scene.shapes ; k++) { /* The steps of the scene, scaled */
+      for (j = 0 ; j < 2 ; j++) {
+        scene.shape[k].steps[j] = (int)ceil(ctx.scene.shape[k].steps[j]*densities[d]) ;
+      }
+    }
+    for (k = 0 ; k < scene.shapes ; k++) {
+      ctx.shape = k ;
+      sprintf(name,"generate.%s",shape_names[scene.shape[k].type]) ;
+      bench_run(name,densities[d],0,0,(long)(scene.shape[k].steps[0] + 1)*(scene.shape[k].steps[1] + 1),bench_generate,NULL,NULL) ;
+      generateShapePoints(&ctx.meshes[k],&scene.shape[k]) ; /* In case the benchmark was left out */
+    }
+
+    for (r = 0 ; r < nsizes ; r++) {
+      long quads = 0 ;
+
+      camera.w = (int)sizes[r] ;
+      camera.h = heights[r] ;
+      fb_alloc(&ctx.fb,camera.w,camera.h) ;
+      for (k = 0 ; k < scene.shapes ; k++) quads += ctx.meshes[k].quads ;
+
+      bench_run("shade",densities[d],camera.w,camera.h,quads,bench_shade,NULL,NULL) ;
+      shadeScene(ctx.meshes,&ctx.polygons) ;
+      pb_visible_order(&ctx.polygons,ctx.rejected) ;
+      bench_run("sort",densities[d],camera.w,camera.h,ctx.polygons.visible,bench_sort,bench_order,NULL) ;
+      pb_sort_far_to_near(&ctx.polygons) ;
+
+      ctx.fill = XFillConvexPolygon ;
+      bench_run("fill.real.scanline",densities[d],camera.w,camera.h,ctx.polygons.visible,bench_fill,bench_clear,&ctx.polygons) ;
+      ctx.fill = XFillConvexPolygonSpans ;
+      bench_run("fill.real.span",densities[d],camera.w,camera.h,ctx.polygons.visible,bench_fill,bench_clear,&ctx.polygons) ;
+      if (d == 0) { /* The synthetic polygons do not depend on the density */
+        bench_synthetic(&ctx.synthetic,camera.w,camera.h) ;
+        ctx.fill = XFillConvexPolygon ;
+        bench_run("fill.synthetic.scanline",0,camera.w,camera.h,BENCH_SYNTHETIC,bench_fill,bench_clear,&ctx.synthetic) ;
+        ctx.fill = XFillConvexPolygonSpans ;
+        bench_run("fill.synthetic.span",0,camera.w,camera.h,BENCH_SYNTHETIC,bench_fill,bench_clear,&ctx.synthetic) ;
+      }
+      bench_run("frame",densities[d],camera.w,camera.h,quads,bench_frame,NULL,NULL) ;
+      fb_free(&ctx.fb) ;
+    }
+  }
+
+  if (bench.format == BENCH_JSON) {
+    fprintf(bench.out,"\n]}\n") ;
+  }
+  if (output) fclose(bench.out) ;
+  for (k = 0 ; k < SCENE_MAX_SHAPES ; k++) mesh_free(&ctx.meshes[k]) ;
+  pb_free(&ctx.polygons) ;
+  pb_free(&ctx.synthetic) ;
+  dmat_arena = NULL ;
+  dmat_arena_free(&frameArena) ;
+  workers_stop() ;
+  return 0 ;
+}
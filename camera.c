@@ -21,120 +21,178 @@
 #define NP 5.0
 #define FP 50.0
 
+#define NEAR_LIMIT 0.1 /* Nearest view distance drawn. NP only sets the depth mapping, the default scene reaches well inside it. */
+
 #define THETA 90.0
 
 #define W  512
 #define H  512
 
-#define ASPECT (double)W/(double)H 
+/* The lens and image of the camera. It starts out as the defines above,
+   a scene file can replace any of it before the first frame. */
 
-dmatrix_t *build_camera_matrix(dmatrix_t *E, dmatrix_t *G) {
-    
-    dmatrix_t N ; /* Viewing axis */
-    
-    N = *dmat_normalize(dmat_sub(E,G)) ;
-    N.l = 3 ;
+typedef struct {
+    vec4_t up ;        /* Up direction of the view, UP */
+    double np, fp ;    /* Near and far planes of the depth mapping, NP and FP */
+    double theta ;     /* Vertical field of view in degrees, THETA */
+    int w, h ;         /* Image size in pixels, W and H */
+} camera_t ;
 
-    dmatrix_t UP ;
-    dmat_alloc(&UP,4,1) ;
-    UP.l = 3 ;
-    
-    UP.m[1][1] = UPx ;
-    UP.m[2][1] = UPy ;
-    UP.m[3][1] = UPz ;
-    UP.m[4][1] = 1.0 ;
-    
-    dmatrix_t U ;
-    
-    U = *dmat_normalize(dcross_product(&UP,&N)) ;
+camera_t camera = { {UPx,UPy,UPz,0.0}, NP, FP, THETA, W, H } ;
+
+#define ASPECT ((double)camera.w/(double)camera.h)
+
+typedef struct {
+    vec4_t plane[6] ; /* Near, far, left, right, bottom, top; P is inside plane k when plane[k].P + plane[k].w >= 0 */
+} frustum_t ;
+
+/* Camera axes: U to the right, V up, N from the gaze point back to the eye */
+
+void camera_axes(vec4_t E, vec4_t G, vec4_t *U, vec4_t *V, vec4_t *N) {
+
+    vec4_t UP = camera.up ;
+
+    *N = vec4_normalize(vec4_from_homogeneous(vec4_sub(E,G))) ;
+    *U = vec4_normalize(vec4_cross(UP,*N)) ;
+    *V = vec4_cross(*N,*U) ;
+}
+
+mat4_t build_camera_matrix(vec4_t E, vec4_t G) {
     
-    dmatrix_t V ;
-    V = *dcross_product(&N,&U) ;
+    vec4_t U, V, N ;
+
+    camera_axes(E,G,&U,&V,&N) ;
     
-    dmatrix_t Mv ; /* Build matrix M_v */
-    dmat_alloc(&Mv,4,4) ;
+    mat4_t Mv ; /* Build matrix M_v */
     
-    Mv.m[1][1] = U.m[1][1] ; 
-    Mv.m[1][2] = U.m[2][1] ; 
-    Mv.m[1][3] = U.m[3][1] ; 
-    Mv.m[1][4] = -1.0*((*E).m[1][1]*U.m[1][1] + (*E).m[2][1]*U.m[2][1] + (*E).m[3][1]*U.m[3][1]) ;
+    Mv.m[0][0] = U.x ; 
+    Mv.m[0][1] = U.y ; 
+    Mv.m[0][2] = U.z ; 
+    Mv.m[0][3] = -1.0*(E.x*U.x + E.y*U.y + E.z*U.z) ;
     
-    Mv.m[2][1] = V.m[1][1] ; 
-    Mv.m[2][2] = V.m[2][1] ; 
-    Mv.m[2][3] = V.m[3][1] ; 
-    Mv.m[2][4] = -1.0*((*E).m[1][1]*V.m[1][1] + (*E).m[2][1]*V.m[2][1] + (*E).m[3][1]*V.m[3][1]) ;
+    Mv.m[1][0] = V.x ; 
+    Mv.m[1][1] = V.y ; 
+    Mv.m[1][2] = V.z ; 
+    Mv.m[1][3] = -1.0*(E.x*V.x + E.y*V.y + E.z*V.z) ;
     
-    Mv.m[3][1] = N.m[1][1] ; 
-    Mv.m[3][2] = N.m[2][1] ; 
-    Mv.m[3][3] = N.m[3][1] ; 
-    Mv.m[3][4] = -1.0*((*E).m[1][1]*N.m[1][1] + (*E).m[2][1]*N.m[2][1] + (*E).m[3][1]*N.m[3][1]) ;
+    Mv.m[2][0] = N.x ; 
+    Mv.m[2][1] = N.y ; 
+    Mv.m[2][2] = N.z ; 
+    Mv.m[2][3] = -1.0*(E.x*N.x + E.y*N.y + E.z*N.z) ;
     
-    Mv.m[4][1] = 0.0 ; 
-    Mv.m[4][2] = 0.0 ; 
-    Mv.m[4][3] = 0.0 ; 
-    Mv.m[4][4] = 1.0 ;
+    Mv.m[3][0] = 0.0 ; 
+    Mv.m[3][1] = 0.0 ; 
+    Mv.m[3][2] = 0.0 ; 
+    Mv.m[3][3] = 1.0 ;
     
-    dmatrix_t Mp ; /* Build matrix Mp */
-    dmat_alloc(&Mp,4,4) ;
-    Mp = *dmat_identity(&Mp) ;
+    mat4_t Mp = mat4_identity() ; /* Build matrix Mp */
     
-    float a = -1.0*(FP + NP)/(FP - NP) ;
-    float b = -2.0*(FP*NP)/(FP - NP) ;
+    float a = -1.0*(camera.fp + camera.np)/(camera.fp - camera.np) ;
+    float b = -2.0*(camera.fp*camera.np)/(camera.fp - camera.np) ;
     
-    Mp.m[1][1] = NP ;
-    Mp.m[2][2] = NP ;
-    Mp.m[3][3] = a ;
-    Mp.m[3][4] = b ;
-    Mp.m[4][3] = -1.0 ;
-    Mp.m[4][4] = 0.0 ;
+    Mp.m[0][0] = camera.np ;
+    Mp.m[1][1] = camera.np ;
+    Mp.m[2][2] = a ;
+    Mp.m[2][3] = b ;
+    Mp.m[3][2] = -1.0 ;
+    Mp.m[3][3] = 0.0 ;
     
     /* Build matrices T_1 and S_1 */
     
     /* Work out coordinates of near plane corners */
     
-    float top = NP*tan(M_PI/180.0*THETA/2.0) ;
+    float top = camera.np*tan(M_PI/180.0*camera.theta/2.0) ;
     float right = ASPECT*top ;
     float bottom = -top ;
     float left = -right ;
    
-    dmatrix_t T1 ;
-    dmat_alloc(&T1,4,4) ;
+    mat4_t T1 = mat4_identity() ;
     
-    T1 = *dmat_identity(&T1) ;
-    T1.m[1][4] = -(right + left)/2.0 ;
-    T1.m[2][4] = -(top + bottom)/2.0 ;
+    T1.m[0][3] = -(right + left)/2.0 ;
+    T1.m[1][3] = -(top + bottom)/2.0 ;
 
-    dmatrix_t S1 ;
-    dmat_alloc(&S1,4,4) ;
+    mat4_t S1 = mat4_identity() ;
     
-    S1 = *dmat_identity(&S1) ;
-    S1.m[1][1] = 2.0/(right - left) ;
-    S1.m[2][2] = 2.0/(top - bottom) ;
+    S1.m[0][0] = 2.0/(right - left) ;
+    S1.m[1][1] = 2.0/(top - bottom) ;
 
     /* Build matrices T2, S2, and W2 */
     
-    dmatrix_t T2 ;
-    dmatrix_t S2 ;
-    dmatrix_t W2 ;
+    mat4_t T2 = mat4_identity() ;
+    mat4_t S2 = mat4_identity() ;
+    mat4_t W2 = mat4_identity() ;
     
-    dmat_alloc(&T2,4,4) ;
-    dmat_alloc(&S2,4,4) ;
-    dmat_alloc(&W2,4,4) ;
+    T2.m[0][3] = 1.0 ;
+    T2.m[1][3] = 1.0 ;
+
+    S2.m[0][0] = camera.w/2.0 ;
+    S2.m[1][1] = camera.h/2.0 ;
     
-    T2 = *dmat_identity(&T2) ;
-    S2 = *dmat_identity(&S2) ;
-    W2 = *dmat_identity(&W2) ;
+    W2.m[1][1] = -1.0 ;
+    W2.m[1][3] = (double)camera.h ;
     
-    T2.m[1][4] = 1.0 ;
-    T2.m[2][4] = 1.0 ;
-
-    S2.m[1][1] = W/2.0 ;
-    S2.m[2][2] = H/2.0 ;
+    mat4_t C ;
     
-    W2.m[2][2] = -1.0 ;
-    W2.m[2][4] = (double)H ;
+    C = mat4_mult(&Mp,&Mv) ;
+    C = mat4_mult(&T1,&C) ;
+    C = mat4_mult(&S1,&C) ;
+    C = mat4_mult(&T2,&C) ;
+    C = mat4_mult(&S2,&C) ;
+    C = mat4_mult(&W2,&C) ;
     
-    return dmat_mult(&W2,dmat_mult(&S2,dmat_mult(&T2,dmat_mult(&S1,dmat_mult(&T1,dmat_mult(&Mp,&Mv)))))) ;
+    return C ;
+}
+
+vec4_t vec4_perspective_projection(vec4_t P) {
+
+    P.x /= P.w ;
+    P.y /= P.w ;
+    P.z /= P.w ;
+    P.w /= P.w ;
+
+    return P ;
+}
+
+/* Sutherland-Hodgman clipping of the polygon in[0..n-1], in the homogeneous
+   coordinates of build_camera_matrix() before the perspective division,
+   against the near plane w = NEAR_LIMIT. out[] needs room for n + 1
+   vertices. If attr is not NULL, attr[i] is a value carried by vertex i,
+   such as a light intensity, and is interpolated into attr_out[] along
+   with the vertices. Returns the number of vertices kept, 0 if all are
+   behind. */
+
+int clip_near(vec4_t in[], float attr[], int n, vec4_t out[], float attr_out[]) {
+
+    vec4_t A, B ;
+    double da, db, t ;
+    int i, j, m = 0 ;
+
+    for (i = 0 ; i < n ; i++) {
+        j = (i + 1)%n ;
+        A = in[i] ;
+        B = in[j] ;
+        da = A.w - NEAR_LIMIT ;
+        db = B.w - NEAR_LIMIT ;
+        if (da >= 0.0) {
+            if (attr) attr_out[m] = attr[i] ;
+            out[m++] = A ;
+        }
+        if ((da >= 0.0) != (db >= 0.0)) { /* The edge crosses the plane */
+            t = da/(da - db) ;
+            if (attr) attr_out[m] = (float)(attr[i] + t*(attr[j] - attr[i])) ;
+            out[m++] = vec4_add(A,vec4_scalar_mult(vec4_sub(B,A),t)) ;
+        }
+    }
+    return m ;
+}
+
+/* dmatrix_t versions kept for existing callers */
+
+dmatrix_t *build_camera_dmatrix(dmatrix_t *E, dmatrix_t *G) {
+
+    mat4_t C = build_camera_matrix(vec4_from_dmat(E),vec4_from_dmat(G)) ;
+
+    return dmat_from_mat4(&C) ;
 }
 
 dmatrix_t *perspective_projection(dmatrix_t *P) {
@@ -146,3 +204,64 @@ dmatrix_t *perspective_projection(dmatrix_t *P) {
 
     return P ;
 }
+
+/* Plane through the eye frame: points P with n.(P - E) + c >= 0 are inside, n must have w = 0 */
+
+vec4_t frustum_plane(vec4_t n, double c, vec4_t E) {
+
+    n.w = c - vec4_dot(n,vec4_from_homogeneous(E)) ;
+    return n ;
+}
+
+/* World-space planes of the viewing volume seen by build_camera_matrix(E,G), with the near plane at NEAR_LIMIT */
+
+frustum_t build_frustum(vec4_t E, vec4_t G) {
+
+    frustum_t f ;
+    vec4_t U, V, N ;
+    double top = tan(M_PI/180.0*camera.theta/2.0) ; /* Half extents of the view at unit distance */
+    double right = ASPECT*top ;
+
+    camera_axes(E,G,&U,&V,&N) ;
+
+    f.plane[0] = frustum_plane(vec4_scalar_mult(N,-1.0),-NEAR_LIMIT,E) ;
+    f.plane[1] = frustum_plane(N,camera.fp,E) ;
+    f.plane[2] = frustum_plane(vec4_normalize(vec4_sub(U,vec4_scalar_mult(N,right))),0.0,E) ;
+    f.plane[3] = frustum_plane(vec4_normalize(vec4_sub(vec4_scalar_mult(U,-1.0),vec4_scalar_mult(N,right))),0.0,E) ;
+    f.plane[4] = frustum_plane(vec4_normalize(vec4_sub(V,vec4_scalar_mult(N,top))),0.0,E) ;
+    f.plane[5] = frustum_plane(vec4_normalize(vec4_sub(vec4_scalar_mult(V,-1.0),vec4_scalar_mult(N,top))),0.0,E) ;
+    return f ;
+}
+
+/* Screen pixels covered by one world unit, as projected by the camera
+   matrix C of build_camera_matrix(E,G), at the point of the sphere of
+   radius r about c nearest the eye. Sizes scale with 1/w, so the scale at
+   unit distance is measured at c and divided by the nearest view distance,
+   which is held at NEAR_LIMIT or more. */
+
+double projected_scale(const mat4_t *C, vec4_t E, vec4_t G, vec4_t c, double r) {
+
+    vec4_t U, V, N, A, B ;
+    double d ;
+
+    camera_axes(E,G,&U,&V,&N) ;
+    A = mat4_mult_vec4(C,c) ;
+    B = mat4_mult_vec4(C,vec4_add(c,U)) ; /* U is square to the gaze, so B.w == A.w */
+    d = A.w - r ;
+    if (d < NEAR_LIMIT) d = NEAR_LIMIT ;
+    return fabs(B.x - A.x)/d ;
+}
+
+/* Returns 1 if the sphere of radius r about c lies wholly outside one of the planes */
+
+int frustum_cull_sphere(const frustum_t *f, vec4_t c, double r) {
+
+    int k ;
+
+    for (k = 0 ; k < 6 ; k++) {
+        if (f->plane[k].x*c.x + f->plane[k].y*c.y + f->plane[k].z*c.z + f->plane[k].w < -r) {
+            return 1 ;
+        }
+    }
+    return 0 ;
+}
@@ -0,0 +1,341 @@
+/*            PURPOSE : Platform-neutral pixel buffer the renderer draws into
+
+        PREREQUISITES : matrix.h
+
+*/
+
+#include <string.h>
+#include <float.h>
+
+typedef unsigned int pixel_t ; /* 0x00RRGGBB, the layout of a 32 bit top-down DIB */
+
+#define FB_RGB(r,g,b) ((pixel_t)(((unsigned char)(r) << 16) | ((unsigned char)(g) << 8) | (unsigned char)(b)))
+#define FB_RED(c)   (((c) >> 16) & 0xFF)
+#define FB_GREEN(c) (((c) >> 8) & 0xFF)
+#define FB_BLUE(c)  ((c) & 0xFF)
+
+#define FB_WHITE FB_RGB(255,255,255)
+
+#ifndef NO_PROFILE
+#define FB_WRITTEN(fb,n) ((fb)->written += (n))
+#else
+#define FB_WRITTEN(fb,n) ((void)0)
+#endif
+
+typedef struct {
+  pixel_t *pixels ; /* w*h pixels, row-major, row 0 at the top */
+  float *depth ;    /* w*h depth values, NULL until fb_alloc_depth() */
+  int w, h ;
+  int clip_x0, clip_y0, clip_x1, clip_y1 ; /* Drawing is limited to [clip_x0,clip_x1) x [clip_y0,clip_y1) */
+  long written ;    /* Pixels drawn since it was last zeroed, counted unless built with NO_PROFILE */
+} framebuffer_t ;
+
+
+void fb_set_clip(framebuffer_t *fb, int x0, int y0, int x1, int y1) {
+
+  fb->clip_x0 = x0 < 0 ? 0 : x0 ;
+  fb->clip_y0 = y0 < 0 ? 0 : y0 ;
+  fb->clip_x1 = x1 > fb->w ? fb->w : x1 ;
+  fb->clip_y1 = y1 > fb->h ? fb->h : y1 ;
+}
+
+
+void fb_reset_clip(framebuffer_t *fb) {
+
+  fb_set_clip(fb,0,0,fb->w,fb->h) ;
+}
+
+
+void fb_alloc(framebuffer_t *fb, int w, int h) {
+
+  fb->pixels = (pixel_t *)malloc((size_t)w*h*sizeof(pixel_t)) ;
+  if (!fb->pixels) {
+    error("FRAMEBUFFER.C: allocation failure") ;
+  }
+  fb->depth = NULL ;
+  fb->w = w ;
+  fb->h = h ;
+  fb->written = 0 ;
+  fb_reset_clip(fb) ;
+}
+
+
+void fb_alloc_depth(framebuffer_t *fb) {
+
+  if (!fb->depth) {
+    fb->depth = (float *)malloc((size_t)fb->w*fb->h*sizeof(float)) ;
+    if (!fb->depth) {
+      error("FRAMEBUFFER.C: allocation failure") ;
+    }
+  }
+}
+
+
+void fb_free(framebuffer_t *fb) {
+
+  free(fb->pixels) ;
+  free(fb->depth) ;
+  fb->pixels = NULL ;
+  fb->depth = NULL ;
+  fb->w = fb->h = 0 ;
+}
+
+
+void fb_clear(framebuffer_t *fb, pixel_t color) {
+
+  int i ;
+
+  for (i = 0 ; i < fb->w*fb->h ; i++) {
+    fb->pixels[i] = color ;
+  }
+}
+
+
+void fb_clear_depth(framebuffer_t *fb) {
+
+  int i ;
+
+  for (i = 0 ; i < fb->w*fb->h ; i++) {
+    fb->depth[i] = FLT_MAX ;
+  }
+}
+
+
+void fb_set_pixel(framebuffer_t *fb, int x, int y, pixel_t color) {
+
+  if (x >= fb->clip_x0 && x < fb->clip_x1 && y >= fb->clip_y0 && y < fb->clip_y1) { /* Pixels off the buffer are dropped, like SetPixel */
+    fb->pixels[y*fb->w + x] = color ;
+    FB_WRITTEN(fb,1) ;
+  }
+}
+
+
+void fb_fill_span(framebuffer_t *fb, int y, int x0, int x1, pixel_t color) {
+
+  pixel_t *p, *end ;
+
+  if (y < fb->clip_y0 || y >= fb->clip_y1) {
+    return ;
+  }
+  if (x0 < fb->clip_x0) x0 = fb->clip_x0 ;
+  if (x1 > fb->clip_x1) x1 = fb->clip_x1 ;
+  if (x0 < x1) FB_WRITTEN(fb,x1 - x0) ;
+
+  p = fb->pixels + y*fb->w ; /* Fills [x0,x1) as one contiguous run */
+  for (end = p + x1, p += x0 ; p < end ; p++) {
+    *p = color ;
+  }
+}
+
+
+void fb_depth_span(framebuffer_t *fb, int y, int x0, int x1, double z, double dz, pixel_t color) {
+
+  pixel_t *p ;
+  float *d ;
+  int x ;
+
+  if (y < fb->clip_y0 || y >= fb->clip_y1) {
+    return ;
+  }
+  if (x0 < fb->clip_x0) {
+    z += (fb->clip_x0 - x0)*dz ;
+    x0 = fb->clip_x0 ;
+  }
+  if (x1 > fb->clip_x1) x1 = fb->clip_x1 ;
+
+  p = fb->pixels + y*fb->w ; /* Like fb_fill_span, but only pixels nearer than the depth buffer are written */
+  d = fb->depth + y*fb->w ;
+  for (x = x0 ; x < x1 ; x++, z += dz) {
+    if (z < d[x]) {
+      d[x] = (float)z ;
+      p[x] = color ;
+      FB_WRITTEN(fb,1) ;
+    }
+  }
+}
+
+
+/* Gouraud span: color is scaled by the intensity s, which steps by ds from
+   pixel to pixel. With depth_test, z and dz work as in fb_depth_span(). */
+
+void fb_shade_span(framebuffer_t *fb, int y, int x0, int x1, pixel_t color, double s, double ds, int depth_test, double z, double dz) {
+
+  float r = FB_RED(color), g = FB_GREEN(color), b = FB_BLUE(color) ;
+  pixel_t *p ;
+  float *d ;
+  int x ;
+
+  if (y < fb->clip_y0 || y >= fb->clip_y1) {
+    return ;
+  }
+  if (x0 < fb->clip_x0) {
+    s += (fb->clip_x0 - x0)*ds ;
+    z += (fb->clip_x0 - x0)*dz ;
+    x0 = fb->clip_x0 ;
+  }
+  if (x1 > fb->clip_x1) x1 = fb->clip_x1 ;
+
+  p = fb->pixels + y*fb->w ;
+  if (!depth_test) {
+    for (x = x0 ; x < x1 ; x++, s += ds) {
+      p[x] = FB_RGB(r*s,g*s,b*s) ;
+    }
+    if (x0 < x1) FB_WRITTEN(fb,x1 - x0) ;
+    return ;
+  }
+  d = fb->depth + y*fb->w ;
+  for (x = x0 ; x < x1 ; x++, s += ds, z += dz) {
+    if (z < d[x]) {
+      d[x] = (float)z ;
+      p[x] = FB_RGB(r*s,g*s,b*s) ;
+      FB_WRITTEN(fb,1) ;
+    }
+  }
+}
+
+
+/* Copies the rectangle [x0,x1) x [y0,y1) of src into the same place in dst */
+
+void fb_copy_rect(framebuffer_t *dst, framebuffer_t *src, int x0, int y0, int x1, int y1) {
+
+  int y ;
+
+  if (x0 < 0) x0 = 0 ;
+  if (y0 < 0) y0 = 0 ;
+  if (x1 > src->w) x1 = src->w ;
+  if (x1 > dst->w) x1 = dst->w ;
+  if (y1 > src->h) y1 = src->h ;
+  if (y1 > dst->h) y1 = dst->h ;
+
+  for (y = y0 ; y < y1 && x0 < x1 ; y++) {
+    memcpy(dst->pixels + y*dst->w + x0,src->pixels + y*src->w + x0,(size_t)(x1 - x0)*sizeof(pixel_t)) ;
+  }
+}
+
+
+int fb_write_ppm(framebuffer_t *fb, const char *filename) {
+
+  FILE *f ;
+  unsigned char *row ;
+  int x, y ;
+
+  f = fopen(filename,"wb") ;
+  if (!f) {
+    return 0 ;
+  }
+  row = (unsigned char *)malloc((size_t)fb->w*3) ;
+  if (!row) {
+    error("FRAMEBUFFER.C: allocation failure") ;
+  }
+  fprintf(f,"P6\n%d %d\n255\n",fb->w,fb->h) ;
+  for (y = 0 ; y < fb->h ; y++) {
+    for (x = 0 ; x < fb->w ; x++) {
+      pixel_t c = fb->pixels[y*fb->w + x] ;
+      row[3*x] = FB_RED(c) ;
+      row[3*x + 1] = FB_GREEN(c) ;
+      row[3*x + 2] = FB_BLUE(c) ;
+    }
+    fwrite(row,1,(size_t)fb->w*3,f) ;
+  }
+  free(row) ;
+  return fclose(f) == 0 ;
+}
+
+
+/* Reads the next number of a PPM header, skipping white space and # comments */
+
+int fb_ppm_number(FILE *f, int *n) {
+
+  int c ;
+
+  while ((c = fgetc(f)) != EOF) {
+    if (c == '#') {
+      while ((c = fgetc(f)) != EOF && c != '\n') ;
+    }
+    else if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+      break ;
+    }
+  }
+  ungetc(c,f) ;
+  return fscanf(f,"%d",n) == 1 ;
+}
+
+
+/* Reads a binary PPM (P6) with 8 bit channels, as fb_write_ppm writes
+   them, into a newly allocated fb. Returns 0 if the file cannot be read. */
+
+int fb_read_ppm(framebuffer_t *fb, const char *filename) {
+
+  FILE *f ;
+  unsigned char *row ;
+  int w, h, max, x, y, ok ;
+
+  f = fopen(filename,"rb") ;
+  if (!f) {
+    return 0 ;
+  }
+  ok = fgetc(f) == 'P' && fgetc(f) == '6' && fb_ppm_number(f,&w) && fb_ppm_number(f,&h) && fb_ppm_number(f,&max) &&
+       w > 0 && h > 0 && w <= 16384 && h <= 16384 && max == 255 && fgetc(f) != EOF ; /* One white space character ends the header */
+  if (!ok) {
+    fclose(f) ;
+    return 0 ;
+  }
+  fb_alloc(fb,w,h) ;
+  row = (unsigned char *)malloc((size_t)w*3) ;
+  if (!row) {
+    error("FRAMEBUFFER.C: allocation failure") ;
+  }
+  for (y = 0 ; y < h && ok ; y++) {
+    ok = fread(row,1,(size_t)w*3,f) == (size_t)w*3 ;
+    for (x = 0 ; x < w && ok ; x++) {
+      fb->pixels[y*w + x] = FB_RGB(row[3*x],row[3*x + 1],row[3*x + 2]) ;
+    }
+  }
+  free(row) ;
+  fclose(f) ;
+  if (!ok) {
+    fb_free(fb) ;
+  }
+  return ok ;
+}
+
+
+typedef struct {
+  long pixels ;   /* Pixels with a channel further off than the tolerance */
+  int max_diff ;  /* Largest difference in any channel */
+  double psnr ;   /* Peak signal to noise ratio over all channels in dB, DBL_MAX when the images are equal */
+} fb_diff_t ;
+
+
+/* Compares fb with the reference ref, which must be the same size. If diff
+   is not NULL it receives an image of the differences: the reference in
+   grey, with each pixel off by more than tolerance in red, brighter
+   the further off it is. */
+
+void fb_compare(framebuffer_t *fb, framebuffer_t *ref, int tolerance, framebuffer_t *diff, fb_diff_t *r) {
+
+  double sum = 0.0 ;
+  pixel_t a, b ;
+  int i, k, d, worst, grey ;
+
+  r->pixels = 0 ;
+  r->max_diff = 0 ;
+  for (i = 0 ; i < fb->w*fb->h ; i++) {
+    a = fb->pixels[i] ;
+    b = ref->pixels[i] ;
+    for (worst = 0, k = 0 ; k < 24 ; k += 8) {
+      d = (int)((a >> k) & 0xFF) - (int)((b >> k) & 0xFF) ;
+      sum += (double)d*d ;
+      if (d < 0) d = -d ;
+      if (d > worst) worst = d ;
+    }
+    if (worst > r->max_diff) r->max_diff = worst ;
+    if (worst > tolerance) r->pixels++ ;
+    if (diff) {
+      grey = 32 + (int)(FB_RED(b) + FB_GREEN(b) + FB_BLUE(b))/8 ; /* Half the brightness, lifted off black */
+      diff->pixels[i] = worst > tolerance ? FB_RGB(128 + worst/2,0,0) : FB_RGB(grey,grey,grey) ;
+    }
+  }
+  sum /= 3.0*fb->w*fb->h ;
+  r->psnr = sum > 0.0 ? 10.0*log10(255.0*255.0/sum) : DBL_MAX ;
+}
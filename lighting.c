@@ -0,0 +1,106 @@
+/*            PURPOSE : Phong lighting of whole batches of polygons or vertices
+
+        PREREQUISITES : matrix.h, transform.c (shares its choice of SIMD width)
+
+*/
+
+typedef struct {
+  float Ls ;  /* Intensity of the light source */
+  float Ia ;  /* Ambient light */
+  float Pd ;  /* Diffuse coefficient */
+  float Pa ;  /* Ambient coefficient */
+  float Ps ;  /* Specular coefficient */
+} phong_t ;
+
+
+/* Lights n surface points from their unit normals (nx,ny,nz) and positions
+   (cx,cy,cz) with a point light at L seen from E, and writes the total
+   intensity Id + Ia*Pa + Is of each into intensity[]. The points are the
+   centroids of flat polygons, or mesh vertices for Gouraud shading. With unit normals the
+   reflected ray is already unit length, so no norms are taken beyond the two
+   normalisations of s and v. A normal that is not a number (a degenerate
+   quad) gets the ambient term only. With accumulate set the intensities
+   are added to those already in intensity[], for scenes with more than one
+   light; the later lights then have Ia = 0. */
+
+void light_points(const phong_t *m, vec4_t L, vec4_t E, int n, const float *nx, const float *ny, const float *nz, const float *cx, const float *cy, const float *cz, float *intensity, int accumulate) {
+
+  float lx = (float)L.x, ly = (float)L.y, lz = (float)L.z ;
+  float ex = (float)E.x, ey = (float)E.y, ez = (float)E.z ;
+  float kd = m->Ls*m->Pd, ks = m->Ls*m->Ps, ka = m->Ia*m->Pa ;
+  float sx, sy, sz, vx, vy, vz, rx, ry, rz, d, t ;
+  int i = 0 ;
+
+#if TRANSFORM_WIDTH > 1
+  {
+    __m128 Lx4 = _mm_set1_ps(lx), Ly4 = _mm_set1_ps(ly), Lz4 = _mm_set1_ps(lz) ;
+    __m128 Ex4 = _mm_set1_ps(ex), Ey4 = _mm_set1_ps(ey), Ez4 = _mm_set1_ps(ez) ;
+    __m128 Kd4 = _mm_set1_ps(kd), Ks4 = _mm_set1_ps(ks), Ka4 = _mm_set1_ps(ka) ;
+    __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f) ;
+    __m128 Nx4, Ny4, Nz4, Cx4, Cy4, Cz4, Sx4, Sy4, Sz4, Vx4, Vy4, Vz4, Rx4, Ry4, Rz4, D4, T4 ;
+
+    for ( ; i + 4 <= n ; i += 4) {
+      Nx4 = _mm_loadu_ps(nx + i) ;
+      Ny4 = _mm_loadu_ps(ny + i) ;
+      Nz4 = _mm_loadu_ps(nz + i) ;
+      Cx4 = _mm_loadu_ps(cx + i) ;
+      Cy4 = _mm_loadu_ps(cy + i) ;
+      Cz4 = _mm_loadu_ps(cz + i) ;
+
+      Sx4 = _mm_sub_ps(Lx4,Cx4) ; /* s, towards the light */
+      Sy4 = _mm_sub_ps(Ly4,Cy4) ;
+      Sz4 = _mm_sub_ps(Lz4,Cz4) ;
+      T4 = _mm_div_ps(one,_mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(Sx4,Sx4),_mm_mul_ps(Sy4,Sy4)),_mm_mul_ps(Sz4,Sz4)))) ;
+      Sx4 = _mm_mul_ps(Sx4,T4) ;
+      Sy4 = _mm_mul_ps(Sy4,T4) ;
+      Sz4 = _mm_mul_ps(Sz4,T4) ;
+
+      Vx4 = _mm_sub_ps(Ex4,Cx4) ; /* v, towards the eye */
+      Vy4 = _mm_sub_ps(Ey4,Cy4) ;
+      Vz4 = _mm_sub_ps(Ez4,Cz4) ;
+      T4 = _mm_div_ps(one,_mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(Vx4,Vx4),_mm_mul_ps(Vy4,Vy4)),_mm_mul_ps(Vz4,Vz4)))) ;
+      Vx4 = _mm_mul_ps(Vx4,T4) ;
+      Vy4 = _mm_mul_ps(Vy4,T4) ;
+      Vz4 = _mm_mul_ps(Vz4,T4) ;
+
+      D4 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(Sx4,Nx4),_mm_mul_ps(Sy4,Ny4)),_mm_mul_ps(Sz4,Nz4)) ;
+      T4 = _mm_add_ps(D4,D4) ;
+      Rx4 = _mm_sub_ps(_mm_mul_ps(T4,Nx4),Sx4) ; /* r = 2(s.n)n - s */
+      Ry4 = _mm_sub_ps(_mm_mul_ps(T4,Ny4),Sy4) ;
+      Rz4 = _mm_sub_ps(_mm_mul_ps(T4,Nz4),Sz4) ;
+      T4 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(Rx4,Vx4),_mm_mul_ps(Ry4,Vy4)),_mm_mul_ps(Rz4,Vz4)) ;
+
+      /* _mm_max_ps returns its second operand when either is NaN, so a NaN normal lights to 0 */
+      T4 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(Kd4,_mm_max_ps(D4,zero)),Ka4),_mm_mul_ps(Ks4,_mm_max_ps(T4,zero))) ;
+      _mm_storeu_ps(intensity + i,accumulate ? _mm_add_ps(_mm_loadu_ps(intensity + i),T4) : T4) ;
+    }
+  }
+#endif
+  for ( ; i < n ; i++) {
+    sx = lx - cx[i] ;
+    sy = ly - cy[i] ;
+    sz = lz - cz[i] ;
+    t = 1.0f/sqrtf((sx*sx + sy*sy) + sz*sz) ;
+    sx *= t ;
+    sy *= t ;
+    sz *= t ;
+
+    vx = ex - cx[i] ;
+    vy = ey - cy[i] ;
+    vz = ez - cz[i] ;
+    t = 1.0f/sqrtf((vx*vx + vy*vy) + vz*vz) ;
+    vx *= t ;
+    vy *= t ;
+    vz *= t ;
+
+    d = (sx*nx[i] + sy*ny[i]) + sz*nz[i] ;
+    t = d + d ;
+    rx = t*nx[i] - sx ;
+    ry = t*ny[i] - sy ;
+    rz = t*nz[i] - sz ;
+    t = (rx*vx + ry*vy) + rz*vz ;
+
+    t = (kd*(d > 0.0f ? d : 0.0f) + ka) + ks*(t > 0.0f ? t : 0.0f) ;
+    intensity[i] = accumulate ? intensity[i] + t : t ;
+  }
+}
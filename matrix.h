@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 
 typedef struct {
   double **m ;
@@ -24,6 +25,93 @@ void error(char error_text[])
 }
 
 
+/* Optional arena for matrix temporaries. While dmat_arena points at one,
+   dmat_malloc() hands out its memory by bumping a pointer and dmat_free()
+   leaves it alone; dmat_arena_release() takes back everything allocated
+   since the matching dmat_arena_mark() in one go. Once the arena is full,
+   blocks come from malloc() as before. An arena must only be used from
+   one thread. */
+
+typedef struct {
+  char *base ;
+  size_t size ;  /* Bytes reserved */
+  size_t used ;  /* Bytes handed out */
+  size_t peak ;  /* Most bytes handed out since peak was last reset */
+} dmat_arena_t ;
+
+#define DMAT_ARENA_ALIGN 16
+
+dmat_arena_t *dmat_arena = NULL ; /* The arena dmat_malloc() takes from, or NULL for the heap */
+
+
+void dmat_arena_init(dmat_arena_t *a, size_t size)
+
+{ a->base = (char *)malloc(size) ;
+  if (!a->base) {
+    error("MATRIX.H: allocation failure") ;
+  }
+  a->size = size ;
+  a->used = 0 ;
+  a->peak = 0 ;
+}
+
+
+void dmat_arena_free(dmat_arena_t *a)
+
+{ if (dmat_arena == a) {
+    dmat_arena = NULL ;
+  }
+  free(a->base) ;
+  a->base = NULL ;
+  a->size = a->used = a->peak = 0 ;
+}
+
+
+size_t dmat_arena_mark(void)
+
+{ return dmat_arena ? dmat_arena->used : 0 ;
+}
+
+
+void dmat_arena_release(size_t mark)
+
+{ if (dmat_arena && mark <= dmat_arena->used) {
+    dmat_arena->used = mark ;
+  }
+}
+
+
+long dmat_allocations = 0 ; /* Heap blocks allocated through dmat_malloc(), read by the profiler */
+
+void *dmat_malloc(size_t size)
+
+{ size_t rounded = (size + DMAT_ARENA_ALIGN - 1) & ~(size_t)(DMAT_ARENA_ALIGN - 1) ;
+  void *p ;
+
+  if (dmat_arena && rounded <= dmat_arena->size - dmat_arena->used) {
+    p = dmat_arena->base + dmat_arena->used ;
+    dmat_arena->used += rounded ;
+    if (dmat_arena->used > dmat_arena->peak) {
+      dmat_arena->peak = dmat_arena->used ;
+    }
+    return p ;
+  }
+#ifndef NO_PROFILE
+  dmat_allocations++ ;
+#endif
+  return malloc(size) ;
+}
+
+
+void dmat_free(void *p)
+
+{ if (dmat_arena && (char *)p >= dmat_arena->base && (char *)p < dmat_arena->base + dmat_arena->size) {
+    return ; /* Taken back by dmat_arena_release() */
+  }
+  free(p) ;
+}
+
+
 void write_dmatrix(dmatrix_t *M)
 
 { int i, j ;
@@ -37,23 +125,31 @@ void write_dmatrix(dmatrix_t *M)
 }
 
 
+/* The matrix is one block, and m is its start: the row table, with
+   unused slots for the rows below nrl and padded to a whole number of
+   doubles, then ncl unused doubles, then the elements in row-major order.
+   So m[i][j] lies inside the block for every row and column in range,
+   without the pointers before the allocation that Numerical Recipes
+   offsets to, and m[nrl] + ncl is the start of a contiguous rows x cols
+   array (see dmat_data). The lower bounds must not be negative. */
+
 double **dmatrix(int nrl, int nrh, int ncl, int nch)
 
-{ int i ;
-  double **m ;
+{ int i, rows = nrh - nrl + 1, cols = nch - ncl + 1 ;
+  size_t table = ((size_t)(nrh + 1)*sizeof(double *) + sizeof(double) - 1)/sizeof(double)*sizeof(double) ;
+  double **m, *data ;
 
-  m = (double **)malloc((unsigned) (nrh - nrl +1)*sizeof(double)) ;
+  if (nrl < 0 || ncl < 0) {
+    error("MATRIX.H: negative lower bound") ;
+  }
+  m = (double **)dmat_malloc(table + ((size_t)ncl + (size_t)rows*cols)*sizeof(double)) ;
   if (!m) {
     error("MATRIX.H: allocation failure") ;
   }
-  m -= nrl ;
+  data = (double *)((char *)m + table) ;
 
   for (i = nrl ; i <= nrh ; i++) {
-    m[i] = (double *)malloc((unsigned) (nch - ncl + 1)*sizeof(double)) ;
-    if (!m[i]) {
-      error("MATRIX.H: allocation failure") ;
-    }
-    m[i] -= ncl ;
+    m[i] = data + (size_t)(i - nrl)*cols ;
   }
   return m ;
 }
@@ -61,19 +157,14 @@ double **dmatrix(int nrl, int nrh, int ncl, int nch)
 
 void free_dmatrix(double **m, int nrl, int nrh, int ncl, int nch)
 
-{ int i ; 
-
-  for (i = nrh ; i >= nrl ; i--) {
-    free((char *) (m[i] + ncl)) ;
-  }
-  free((char *) (m + nrl)) ;
+{ dmat_free(m) ; /* The rows live in the same block */
 }
 
 
 void delete_dmatrix(dmatrix_t *A)
 
 { free_dmatrix(A->m,1,A->l,1,A->c) ;
-  free(A) ;
+  dmat_free(A) ;
 }
 
 
@@ -85,18 +176,22 @@ void dmat_alloc(dmatrix_t *A, int l, int c)
 }
 
 
+/* The l x c elements of A as one row-major array, for routines that take a
+   plain pointer and a leading dimension of c */
+
+double *dmat_data(dmatrix_t *A)
+
+{ return &(*A).m[1][1] ;
+}
+
+
 dmatrix_t *dmat_duplicate(dmatrix_t *A) 
 
-{ int i, j ;
-  dmatrix_t *B ;
-  B = (dmatrix_t *)malloc(sizeof(dmatrix_t)) ;
-  dmat_alloc(B,(*A).l,(*A).c) ;
+{ dmatrix_t *B ;
 
-  for (i = 1 ; i <= (*A).l ; i++) {
-    for (j = 1 ; j <= (*A).c ; j++) {
-      (*B).m[i][j] = (*A).m[i][j] ; 
-    }
-  }
+  B = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
+  dmat_alloc(B,(*A).l,(*A).c) ;
+  memcpy(dmat_data(B),dmat_data(A),(size_t)(*A).l*(*A).c*sizeof(double)) ;
   return B ;
 }
 
@@ -137,7 +232,7 @@ dmatrix_t *dmat_scalar_mult(dmatrix_t *A, double a)
 {  dmatrix_t *B ;
    int i, j ;
 
-  B = (dmatrix_t *)malloc(sizeof(dmatrix_t)) ;
+  B = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
   dmat_alloc(B,(*A).l,(*A).c) ;
 
   for (i = 1 ; i <= (*A).l ; i++) {
@@ -152,21 +247,24 @@ dmatrix_t *dmat_scalar_mult(dmatrix_t *A, double a)
 dmatrix_t *dmat_mult(dmatrix_t *A, dmatrix_t *B) 
 
 { dmatrix_t *C ;
-  double s ;
+  double a, *c, *b ;
   int i, j, k ;
 
   if ((*A).c != (*B).l) {
     error("MATRIX.H: incompatible matrix sizes") ;
   }
-  C = (dmatrix_t *)malloc(sizeof(dmatrix_t)) ;
+  C = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
   dmat_alloc(C,(*A).l,(*B).c) ;
-
-  for (i = 1 ; i <= (*C).l ; i++) {
-    for (j = 1 ; j <= (*C).c ; j++) {
-      for (s = 0.0, k = 1 ; k <= (*A).c ; k++) {
-        s += (*A).m[i][k]*(*B).m[k][j] ;
+  dmat_init(C,0.0) ;
+
+  for (i = 1 ; i <= (*C).l ; i++) { /* i-k-j order walks B and C along their rows; each sum still runs over k in order */
+    c = (*C).m[i] ;
+    for (k = 1 ; k <= (*A).c ; k++) {
+      a = (*A).m[i][k] ;
+      b = (*B).m[k] ;
+      for (j = 1 ; j <= (*C).c ; j++) {
+        c[j] += a*b[j] ;
       }
-      (*C).m[i][j] = s ;
     }
   }
   return C ;
@@ -182,7 +280,7 @@ dmatrix_t *dmat_add(dmatrix_t *A, dmatrix_t *B)
   if ((*A).l != (*B).l || (*A).c != (*B).c) {
     error("MATRIX.H: incompatible matrix sizes") ;
   }
-  C = (dmatrix_t *)malloc(sizeof(dmatrix_t)) ;
+  C = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
   dmat_alloc(C,(*A).l,(*A).c) ;
 
   for (i = 1 ; i <= (*C).l ; i++) {
@@ -203,7 +301,7 @@ dmatrix_t *dmat_sub(dmatrix_t *A, dmatrix_t *B)
   if ((*A).l != (*B).l || (*A).c != (*B).c) {
     error("MATRIX.H: incompatible matrix sizes") ;
   }
-  C = (dmatrix_t *)malloc(sizeof(dmatrix_t)) ;
+  C = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
   dmat_alloc(C,(*A).l,(*A).c) ;
 
   for (i = 1 ; i <= (*C).l ; i++) {
@@ -251,7 +349,7 @@ dmatrix_t *dmat_transpose(dmatrix_t *A)
 { dmatrix_t *B ;
   int i, j ;
 
-  B = (dmatrix_t *)malloc(sizeof(dmatrix_t)) ;
+  B = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
   dmat_alloc(B,(*A).c,(*A).l) ;
 
   for (i = 1 ; i <= (*A).l ; i++) {
@@ -267,7 +365,7 @@ double ddot_product(dmatrix_t *A, dmatrix_t *B)
 
 { dmatrix_t *C ;
 
-  C = (dmatrix_t *)malloc(sizeof(dmatrix_t)) ;
+  C = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
 
   if ((*A).c == (*B).c && (*A).l == 1 && (*B).l == 1) { 
     C = dmat_mult(A,dmat_transpose(B)) ;
@@ -291,7 +389,7 @@ dmatrix_t *cross_product_matrix(dmatrix_t *A, dmatrix_t *B)
 { int i, j ; 
   dmatrix_t *C ;
 
-  C = (dmatrix_t *)malloc(sizeof(dmatrix_t)) ;
+  C = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
   dmat_alloc(C,(*A).l,(*A).l) ;
 
   for (i = 1 ; i <= (*A).l ; i++) {
@@ -319,7 +417,7 @@ dmatrix_t *sub_matrix(dmatrix_t *A, int r, int c)
   if (r < 1 || r > (*A).l || c < 1 || c > (*A).c || (*A).c < 2 || (*A).l < 2)  {
      error("MATRIX.H: erroneous indices") ;
   }
-  B = (dmatrix_t *)malloc(sizeof(dmatrix_t)) ;
+  B = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
   dmat_alloc(B,(*A).l-1,(*A).c-1) ;
 
   for (i = 1, k = 1 ; i <= (*A).l ; i++) {
@@ -335,10 +433,104 @@ dmatrix_t *sub_matrix(dmatrix_t *A, int r, int c)
 }
 
 
+/* Closed forms for the small matrices the camera code uses */
+
+double determinant3(double **m)
+
+{ return m[1][1]*(m[2][2]*m[3][3] - m[2][3]*m[3][2])
+       - m[1][2]*(m[2][1]*m[3][3] - m[2][3]*m[3][1])
+       + m[1][3]*(m[2][1]*m[3][2] - m[2][2]*m[3][1]) ;
+}
+
+
+double determinant4(double **m)
+
+{ double s0 = m[1][1]*m[2][2] - m[2][1]*m[1][2], s1 = m[1][1]*m[2][3] - m[2][1]*m[1][3] ;
+  double s2 = m[1][1]*m[2][4] - m[2][1]*m[1][4], s3 = m[1][2]*m[2][3] - m[2][2]*m[1][3] ;
+  double s4 = m[1][2]*m[2][4] - m[2][2]*m[1][4], s5 = m[1][3]*m[2][4] - m[2][3]*m[1][4] ;
+  double c0 = m[3][1]*m[4][2] - m[4][1]*m[3][2], c1 = m[3][1]*m[4][3] - m[4][1]*m[3][3] ;
+  double c2 = m[3][1]*m[4][4] - m[4][1]*m[3][4], c3 = m[3][2]*m[4][3] - m[4][2]*m[3][3] ;
+  double c4 = m[3][2]*m[4][4] - m[4][2]*m[3][4], c5 = m[3][3]*m[4][4] - m[4][3]*m[3][4] ;
+
+  return s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0 ;
+}
+
+
+/* LU decomposition with partial pivoting, in place. A square A is replaced
+   by U on and above the diagonal and by the multipliers of L (whose
+   diagonal is 1) below it, for the rows of the input in the order
+   perm[1..l]. Returns the sign of that permutation, or 0 if A is
+   singular. O(l^3), and nothing is allocated. */
+
+int dmat_lu(dmatrix_t *A, int perm[])
+
+{ int i, j, k, p, n = (*A).l, sign = 1 ;
+  double big, f, t ;
+
+  for (i = 1 ; i <= n ; i++) {
+    perm[i] = i ;
+  }
+  for (k = 1 ; k <= n ; k++) {
+    for (p = k, big = fabs((*A).m[k][k]), i = k + 1 ; i <= n ; i++) { /* Pivot on the largest element of the column */
+      if (fabs((*A).m[i][k]) > big) {
+        big = fabs((*A).m[i][k]) ;
+        p = i ;
+      }
+    }
+    if (big == 0.0) {
+      return 0 ;
+    }
+    if (p != k) {
+      for (j = 1 ; j <= n ; j++) {
+        t = (*A).m[p][j] ;
+        (*A).m[p][j] = (*A).m[k][j] ;
+        (*A).m[k][j] = t ;
+      }
+      i = perm[p] ;
+      perm[p] = perm[k] ;
+      perm[k] = i ;
+      sign = -sign ;
+    }
+    for (i = k + 1 ; i <= n ; i++) {
+      f = (*A).m[i][k] /= (*A).m[k][k] ;
+      for (j = k + 1 ; j <= n ; j++) {
+        (*A).m[i][j] -= f*(*A).m[k][j] ;
+      }
+    }
+  }
+  return sign ;
+}
+
+
+/* Solves A X = B from the decomposition of A by dmat_lu, one column of B at a time, into X */
+
+void dmat_lu_solve(dmatrix_t *LU, int perm[], dmatrix_t *B, dmatrix_t *X)
+
+{ int i, j, c, n = (*LU).l ;
+  double s ;
+
+  for (c = 1 ; c <= (*B).c ; c++) {
+    for (i = 1 ; i <= n ; i++) { /* L y = P b */
+      for (s = (*B).m[perm[i]][c], j = 1 ; j < i ; j++) {
+        s -= (*LU).m[i][j]*(*X).m[j][c] ;
+      }
+      (*X).m[i][c] = s ;
+    }
+    for (i = n ; i >= 1 ; i--) { /* U x = y */
+      for (s = (*X).m[i][c], j = i + 1 ; j <= n ; j++) {
+        s -= (*LU).m[i][j]*(*X).m[j][c] ;
+      }
+      (*X).m[i][c] = s/(*LU).m[i][i] ;
+    }
+  }
+}
+
+
 double determinant(dmatrix_t *A)
 
-{ int i ;
+{ int i, *perm ;
   double det ;
+  dmatrix_t *LU ;
 
   if ((*A).l < 1 || (*A).c < 1) {
     error("MATRIX.H: erroneous matrix size") ;
@@ -349,11 +541,24 @@ double determinant(dmatrix_t *A)
   else if ((*A).l == 1) { 
     det = (*A).m[1][1] ;
   } 
-  else {
-    det = 0.0 ;
-    for (i = 1 ; i <= (*A).c ; i++) {
-      det += pow(-1.0,i+1.0)*(*A).m[1][i]*determinant(sub_matrix(A,1,i)) ;
+  else if ((*A).l == 2) {
+    det = (*A).m[1][1]*(*A).m[2][2] - (*A).m[1][2]*(*A).m[2][1] ;
+  }
+  else if ((*A).l == 3) {
+    det = determinant3((*A).m) ;
+  }
+  else if ((*A).l == 4) {
+    det = determinant4((*A).m) ;
+  }
+  else { /* The product of the pivots */
+    LU = dmat_duplicate(A) ;
+    perm = (int *)dmat_malloc(((*A).l + 1)*sizeof(int)) ;
+    det = dmat_lu(LU,perm) ;
+    for (i = 1 ; i <= (*A).l ; i++) {
+      det *= (*LU).m[i][i] ;
     }
+    dmat_free(perm) ;
+    delete_dmatrix(LU) ;
   }
   return det ;
 }
@@ -364,7 +569,7 @@ dmatrix_t *cofactor(dmatrix_t *A)
 { int i, j ; 
   dmatrix_t *B ;
   
-  B = (dmatrix_t *)malloc(sizeof(dmatrix_t)) ;
+  B = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
   dmat_alloc(B,(*A).l,(*A).c) ;
 
   for (i = 1 ; i <= (*A).l ; i++) {
@@ -376,10 +581,99 @@ dmatrix_t *cofactor(dmatrix_t *A)
 }
 
 
+/* Solves A X = B for X, for a square A and any number of columns in B */
+
+dmatrix_t *dmat_solve(dmatrix_t *A, dmatrix_t *B)
+
+{ dmatrix_t *LU, *X ;
+  int *perm ;
+
+  if ((*A).l < 1 || (*A).l != (*A).c) {
+    error("MATRIX.H: not a square matrix") ;
+  }
+  if ((*B).l != (*A).l) {
+    error("MATRIX.H: incompatible matrix sizes") ;
+  }
+  LU = dmat_duplicate(A) ;
+  perm = (int *)dmat_malloc(((*A).l + 1)*sizeof(int)) ;
+  if (!dmat_lu(LU,perm)) {
+    error("MATRIX.H: singular matrix") ;
+  }
+  X = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
+  dmat_alloc(X,(*B).l,(*B).c) ;
+  dmat_lu_solve(LU,perm,B,X) ;
+  dmat_free(perm) ;
+  delete_dmatrix(LU) ;
+  return X ;
+}
+
+
+/* The adjugate over the determinant for 3x3 and 4x4, LU otherwise */
+
 dmatrix_t *dmat_inverse(dmatrix_t *A)
 
-{ 
-  return dmat_scalar_mult(dmat_transpose(cofactor(A)),1.0/determinant(A)) ;
+{ dmatrix_t *B, I ;
+  double **m = (*A).m, **b, d ;
+
+  if ((*A).l < 1 || (*A).l != (*A).c) {
+    error("MATRIX.H: not a square matrix") ;
+  }
+  if ((*A).l == 3) {
+    if ((d = determinant3(m)) == 0.0) {
+      error("MATRIX.H: singular matrix") ;
+    }
+    B = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
+    dmat_alloc(B,3,3) ;
+    b = (*B).m ;
+    d = 1.0/d ;
+    b[1][1] = (m[2][2]*m[3][3] - m[2][3]*m[3][2])*d ;
+    b[1][2] = (m[1][3]*m[3][2] - m[1][2]*m[3][3])*d ;
+    b[1][3] = (m[1][2]*m[2][3] - m[1][3]*m[2][2])*d ;
+    b[2][1] = (m[2][3]*m[3][1] - m[2][1]*m[3][3])*d ;
+    b[2][2] = (m[1][1]*m[3][3] - m[1][3]*m[3][1])*d ;
+    b[2][3] = (m[1][3]*m[2][1] - m[1][1]*m[2][3])*d ;
+    b[3][1] = (m[2][1]*m[3][2] - m[2][2]*m[3][1])*d ;
+    b[3][2] = (m[1][2]*m[3][1] - m[1][1]*m[3][2])*d ;
+    b[3][3] = (m[1][1]*m[2][2] - m[1][2]*m[2][1])*d ;
+    return B ;
+  }
+  if ((*A).l == 4) {
+    double s0 = m[1][1]*m[2][2] - m[2][1]*m[1][2], s1 = m[1][1]*m[2][3] - m[2][1]*m[1][3] ;
+    double s2 = m[1][1]*m[2][4] - m[2][1]*m[1][4], s3 = m[1][2]*m[2][3] - m[2][2]*m[1][3] ;
+    double s4 = m[1][2]*m[2][4] - m[2][2]*m[1][4], s5 = m[1][3]*m[2][4] - m[2][3]*m[1][4] ;
+    double c0 = m[3][1]*m[4][2] - m[4][1]*m[3][2], c1 = m[3][1]*m[4][3] - m[4][1]*m[3][3] ;
+    double c2 = m[3][1]*m[4][4] - m[4][1]*m[3][4], c3 = m[3][2]*m[4][3] - m[4][2]*m[3][3] ;
+    double c4 = m[3][2]*m[4][4] - m[4][2]*m[3][4], c5 = m[3][3]*m[4][4] - m[4][3]*m[3][4] ;
+
+    if ((d = s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0) == 0.0) { /* As determinant4(), the 2x2 minors are reused below */
+      error("MATRIX.H: singular matrix") ;
+    }
+    B = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
+    dmat_alloc(B,4,4) ;
+    b = (*B).m ;
+    d = 1.0/d ;
+    b[1][1] = ( m[2][2]*c5 - m[2][3]*c4 + m[2][4]*c3)*d ;
+    b[1][2] = (-m[1][2]*c5 + m[1][3]*c4 - m[1][4]*c3)*d ;
+    b[1][3] = ( m[4][2]*s5 - m[4][3]*s4 + m[4][4]*s3)*d ;
+    b[1][4] = (-m[3][2]*s5 + m[3][3]*s4 - m[3][4]*s3)*d ;
+    b[2][1] = (-m[2][1]*c5 + m[2][3]*c2 - m[2][4]*c1)*d ;
+    b[2][2] = ( m[1][1]*c5 - m[1][3]*c2 + m[1][4]*c1)*d ;
+    b[2][3] = (-m[4][1]*s5 + m[4][3]*s2 - m[4][4]*s1)*d ;
+    b[2][4] = ( m[3][1]*s5 - m[3][3]*s2 + m[3][4]*s1)*d ;
+    b[3][1] = ( m[2][1]*c4 - m[2][2]*c2 + m[2][4]*c0)*d ;
+    b[3][2] = (-m[1][1]*c4 + m[1][2]*c2 - m[1][4]*c0)*d ;
+    b[3][3] = ( m[4][1]*s4 - m[4][2]*s2 + m[4][4]*s0)*d ;
+    b[3][4] = (-m[3][1]*s4 + m[3][2]*s2 - m[3][4]*s0)*d ;
+    b[4][1] = (-m[2][1]*c3 + m[2][2]*c1 - m[2][3]*c0)*d ;
+    b[4][2] = ( m[1][1]*c3 - m[1][2]*c1 + m[1][3]*c0)*d ;
+    b[4][3] = (-m[4][1]*s3 + m[4][2]*s1 - m[4][3]*s0)*d ;
+    b[4][4] = ( m[3][1]*s3 - m[3][2]*s1 + m[3][3]*s0)*d ;
+    return B ;
+  }
+  dmat_alloc(&I,(*A).l,(*A).l) ;
+  B = dmat_solve(A,dmat_identity(&I)) ;
+  free_dmatrix(I.m,1,I.l,1,I.c) ;
+  return B ;
 }
 
 
@@ -392,7 +686,7 @@ dmatrix_t *dcross_product(dmatrix_t *A, dmatrix_t *B)
     error("MATRIX.H: Incompatible matrix sizes") ;
   }
 
-  C = (dmatrix_t *)malloc(sizeof(dmatrix_t)) ;
+  C = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
   dmat_alloc(C,(*A).l,(*A).c) ;
 
   for (i = 1 ; i <= (*A).l ; i++) {
@@ -411,7 +705,7 @@ dmatrix_t *to_homogeneous(dmatrix_t *A, double l)
     error("MATRIX.H: erroneous matrix size") ;
   }
 
-  B = (dmatrix_t *)malloc(sizeof(dmatrix_t)) ;
+  B = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
 
   if ((*A).c == 1) {
     dmat_alloc(B,(*A).l+1,1) ;
@@ -450,7 +744,7 @@ dmatrix_t *from_homogeneous(dmatrix_t *A)
     error("MATRIX.H: erroneous matrix size") ;
   }
 
-  B = (dmatrix_t *)malloc(sizeof(dmatrix_t)) ;
+  B = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
 
   if ((*A).c == 1) {
     dmat_alloc(B,(*A).l-1,1) ;
@@ -473,4 +767,198 @@ dmatrix_t *from_homogeneous(dmatrix_t *A)
     }
   }
   return B ;
-} 
\ No newline at end of file
+} 
+
+/* Fixed-size 4x1 / 4x4 value types. These live on the stack and are passed
+   by value (vectors) or by pointer (matrices), so the transform path does not
+   touch the heap. Indices of mat4_t are 0-based and contiguous, row-major. */
+
+typedef struct {
+  double x, y, z, w ;
+} vec4_t ;
+
+typedef struct {
+  double m[4][4] ;
+} mat4_t ;
+
+
+vec4_t vec4_make(double x, double y, double z, double w)
+
+{ vec4_t A ;
+
+  A.x = x ;
+  A.y = y ;
+  A.z = z ;
+  A.w = w ;
+  return A ;
+}
+
+
+double vec4_get(vec4_t A, int i)
+
+{ switch (i) {
+    case 1 : return A.x ;
+    case 2 : return A.y ;
+    case 3 : return A.z ;
+    case 4 : return A.w ;
+  }
+  error("MATRIX.H: erroneous indices") ;
+  return 0.0 ;
+}
+
+
+int vec4_equal(vec4_t A, vec4_t B)
+
+{ return A.x == B.x && A.y == B.y && A.z == B.z && A.w == B.w ;
+}
+
+
+vec4_t vec4_add(vec4_t A, vec4_t B)
+
+{ return vec4_make(A.x + B.x,A.y + B.y,A.z + B.z,A.w + B.w) ;
+}
+
+
+vec4_t vec4_sub(vec4_t A, vec4_t B)
+
+{ return vec4_make(A.x - B.x,A.y - B.y,A.z - B.z,A.w - B.w) ;
+}
+
+
+vec4_t vec4_scalar_mult(vec4_t A, double a)
+
+{ return vec4_make(A.x*a,A.y*a,A.z*a,A.w*a) ;
+}
+
+
+double vec4_dot(vec4_t A, vec4_t B)
+
+{ return A.x*B.x + A.y*B.y + A.z*B.z + A.w*B.w ;
+}
+
+
+double vec4_norm(vec4_t A)
+
+{ return sqrt(vec4_dot(A,A)) ;
+}
+
+
+vec4_t vec4_normalize(vec4_t A)
+
+{ return vec4_scalar_mult(A,1.0/vec4_norm(A)) ;
+}
+
+
+vec4_t vec4_cross(vec4_t A, vec4_t B)
+
+{ return vec4_make(A.y*B.z - A.z*B.y,A.z*B.x - A.x*B.z,A.x*B.y - A.y*B.x,0.0) ;
+}
+
+
+vec4_t vec4_to_homogeneous(vec4_t A, double l)
+
+{ A.w = l ;
+  return A ;
+}
+
+
+vec4_t vec4_from_homogeneous(vec4_t A)
+
+{ A.w = 0.0 ;
+  return A ;
+}
+
+
+mat4_t mat4_identity(void)
+
+{ mat4_t A ;
+  int i, j ;
+
+  for (i = 0 ; i < 4 ; i++) {
+    for (j = 0 ; j < 4 ; j++) {
+      A.m[i][j] = (i == j) ? 1.0 : 0.0 ;
+    }
+  }
+  return A ;
+}
+
+
+mat4_t mat4_mult(const mat4_t *A, const mat4_t *B)
+
+{ mat4_t C ;
+  int i, j ;
+
+  for (i = 0 ; i < 4 ; i++) {
+    for (j = 0 ; j < 4 ; j++) {
+      C.m[i][j] = A->m[i][0]*B->m[0][j] + A->m[i][1]*B->m[1][j] + A->m[i][2]*B->m[2][j] + A->m[i][3]*B->m[3][j] ;
+    }
+  }
+  return C ;
+}
+
+
+vec4_t mat4_mult_vec4(const mat4_t *A, vec4_t P)
+
+{ return vec4_make(A->m[0][0]*P.x + A->m[0][1]*P.y + A->m[0][2]*P.z + A->m[0][3]*P.w,
+                   A->m[1][0]*P.x + A->m[1][1]*P.y + A->m[1][2]*P.z + A->m[1][3]*P.w,
+                   A->m[2][0]*P.x + A->m[2][1]*P.y + A->m[2][2]*P.z + A->m[2][3]*P.w,
+                   A->m[3][0]*P.x + A->m[3][1]*P.y + A->m[3][2]*P.z + A->m[3][3]*P.w) ;
+}
+
+
+/* Compatibility layer between the value types and dmatrix_t */
+
+vec4_t vec4_from_dmat(dmatrix_t *A)
+
+{ if ((*A).c != 1 || (*A).l < 3 || (*A).l > 4) {
+    error("MATRIX.H: incompatible matrix sizes") ;
+  }
+  return vec4_make((*A).m[1][1],(*A).m[2][1],(*A).m[3][1],(*A).l == 4 ? (*A).m[4][1] : 0.0) ;
+}
+
+
+dmatrix_t *dmat_from_vec4(vec4_t A)
+
+{ dmatrix_t *B ;
+
+  B = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
+  dmat_alloc(B,4,1) ;
+  (*B).m[1][1] = A.x ;
+  (*B).m[2][1] = A.y ;
+  (*B).m[3][1] = A.z ;
+  (*B).m[4][1] = A.w ;
+  return B ;
+}
+
+
+mat4_t mat4_from_dmat(dmatrix_t *A)
+
+{ mat4_t B ;
+  int i, j ;
+
+  if ((*A).l != 4 || (*A).c != 4) {
+    error("MATRIX.H: incompatible matrix sizes") ;
+  }
+  for (i = 0 ; i < 4 ; i++) {
+    for (j = 0 ; j < 4 ; j++) {
+      B.m[i][j] = (*A).m[i+1][j+1] ;
+    }
+  }
+  return B ;
+}
+
+
+dmatrix_t *dmat_from_mat4(const mat4_t *A)
+
+{ dmatrix_t *B ;
+  int i, j ;
+
+  B = (dmatrix_t *)dmat_malloc(sizeof(dmatrix_t)) ;
+  dmat_alloc(B,4,4) ;
+  for (i = 0 ; i < 4 ; i++) {
+    for (j = 0 ; j < 4 ; j++) {
+      (*B).m[i+1][j+1] = A->m[i][j] ;
+    }
+  }
+  return B ;
+}
@@ -0,0 +1,118 @@
+/*            PURPOSE : Shared-vertex parametric meshes with quad index buffers
+
+        PREREQUISITES : matrix.h, camera.c, transform.c, framebuffer.c, polygons.c
+
+*/
+
+/* A mesh is a rows x cols grid of vertices evaluated once from a parametric
+   surface, plus POLY_VERTICES indices into the grid for every quad. The
+   world-space grid is kept between frames; only the projected copy is
+   refreshed when the camera changes. */
+
+typedef struct {
+  int rows, cols ;   /* Vertex grid, vertex (r,c) is at r*cols + c */
+  vec4_t *world ;    /* World-space vertices */
+  float *px, *py, *pz ;      /* The same vertices as contiguous arrays, for transform_points(); set by mesh_pack() */
+  float *sx, *sy, *sz, *sw ; /* Screen coordinates and clip-space w of each vertex, the coordinates are only meaningful where sw >= NEAR_LIMIT */
+  float *nx, *ny, *nz ;      /* Unit surface normal at each vertex, for Gouraud shading */
+  float *shade ;             /* Light intensity at each vertex, for Gouraud shading */
+  int quads ;        /* Number of quads, (rows - 1)*(cols - 1) */
+  int *index ;       /* POLY_VERTICES vertex indices per quad, quad q starts at POLY_VERTICES*q */
+  pixel_t color ;    /* Unlit colour of the surface */
+} mesh_t ;
+
+
+void mesh_free(mesh_t *m) {
+
+  free(m->world) ;
+  free(m->px) ; /* px..shade share one block */
+  free(m->index) ;
+  memset(m,0,sizeof(*m)) ;
+}
+
+
+void mesh_alloc(mesh_t *m, int rows, int cols) {
+
+  mesh_free(m) ;
+  m->rows = rows ;
+  m->cols = cols ;
+  m->quads = (rows - 1)*(cols - 1) ;
+  m->world = (vec4_t *)pb_realloc(NULL,rows*cols,sizeof(vec4_t)) ;
+  m->px = (float *)pb_realloc(NULL,11*rows*cols,sizeof(float)) ;
+  m->py = m->px + rows*cols ;
+  m->pz = m->py + rows*cols ;
+  m->sx = m->pz + rows*cols ;
+  m->sy = m->sx + rows*cols ;
+  m->sz = m->sy + rows*cols ;
+  m->sw = m->sz + rows*cols ;
+  m->nx = m->sw + rows*cols ;
+  m->ny = m->nx + rows*cols ;
+  m->nz = m->ny + rows*cols ;
+  m->shade = m->nz + rows*cols ;
+  m->index = (int *)pb_realloc(NULL,POLY_VERTICES*m->quads,sizeof(int)) ;
+}
+
+
+/* Builds the quad index buffer in row-major order. With outer_first the
+   corners run (r,c), (r+1,c), (r+1,c+1), (r,c+1), otherwise (r,c), (r,c+1),
+   (r+1,c+1), (r+1,c); the order fixes which way the quad normal faces. */
+
+void mesh_index_grid(mesh_t *m, int outer_first) {
+
+  int r, c, *q ;
+
+  for (q = m->index, r = 0 ; r < m->rows - 1 ; r++) {
+    for (c = 0 ; c < m->cols - 1 ; c++, q += POLY_VERTICES) {
+      q[0] = r*m->cols + c ;
+      q[1] = outer_first ? (r + 1)*m->cols + c : r*m->cols + c + 1 ;
+      q[2] = (r + 1)*m->cols + c + 1 ;
+      q[3] = outer_first ? r*m->cols + c + 1 : (r + 1)*m->cols + c ;
+    }
+  }
+}
+
+
+/* Level of detail: the number of steps to cover range radians of an arc of
+   radius world units, seen at scale pixels per unit, so that no chord is
+   more than error pixels from the arc. A chord of angle t is r(1 - cos t/2)
+   from the arc, about r t^2/8. A radius of 0 is a straight line. The count
+   is held between min and max. */
+
+int mesh_lod_steps(double range, double radius, double scale, double error, int min, int max) {
+
+  double t ;
+  int n ;
+
+  if (radius*scale <= 0.0) {
+    return min ;
+  }
+  t = sqrt(8.0*error/(radius*scale)) ;
+  n = t < range/max ? max : (int)ceil(range/t) ;
+  if (n < min) n = min ;
+  if (n > max) n = max ;
+  return n ;
+}
+
+
+/* Copies the world-space vertices into px, py and pz once they are all set */
+
+void mesh_pack(mesh_t *m) {
+
+  int i ;
+
+  for (i = 0 ; i < m->rows*m->cols ; i++) {
+    m->px[i] = (float)m->world[i].x ;
+    m->py[i] = (float)m->world[i].y ;
+    m->pz[i] = (float)m->world[i].z ;
+  }
+}
+
+
+/* Transforms and projects vertex rows first_row .. last_row - 1 */
+
+void mesh_project(mesh_t *m, const mat4_t *C, int first_row, int last_row) {
+
+  int i = first_row*m->cols, n = (last_row - first_row)*m->cols ;
+
+  transform_points(C,m->px + i,m->py + i,m->pz + i,n,m->sx + i,m->sy + i,m->sz + i,m->sw + i) ;
+}
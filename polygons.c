@@ -0,0 +1,225 @@
+/*            PURPOSE : Structure-of-arrays store for projected, shaded polygons
+
+        PREREQUISITES : matrix.h, framebuffer.c
+
+*/
+
+#define POLY_VERTICES 4 /* Every tessellated patch is a quad */
+#define POLY_MAX_VERTICES (POLY_VERTICES + 1) /* Clipping a quad to the near plane adds at most one corner */
+
+enum { CULL_NONE, CULL_BACK, CULL_FRUSTUM, CULL_REASONS } ; /* Why a polygon was dropped before lighting */
+
+typedef struct {
+  int count ;         /* Number of polygons stored */
+  int capacity ;      /* Number of polygons the arrays have room for */
+  float *x, *y, *z ;  /* Screen-space vertices, vertex k of polygon i is at POLY_MAX_VERTICES*i + k */
+  unsigned char *vertices ; /* Number of vertices of each polygon */
+  float *depth ;      /* Distance from the eye to the centroid, the painter's sort key */
+  float *nx, *ny, *nz ; /* Unit normal of each polygon, read by the lighting pass */
+  float *cx, *cy, *cz ; /* Centroid of each polygon, read by the lighting pass */
+  float *intensity ;  /* Total light intensity of the polygon, written by the lighting pass */
+  float *shade ;      /* Light intensity at each vertex, laid out like x, for Gouraud shading */
+  pixel_t *color ;    /* Unlit colour of the polygon */
+  unsigned char *culled ; /* CULL_NONE, or why the polygon is not drawn; nothing else is stored for a culled polygon */
+  int *order ;        /* Draw order, the visible polygons among 0..count-1 */
+  int visible ;       /* Number of polygons listed in order */
+  unsigned int *keys ; /* Scratch for pb_sort_far_to_near(), 2*capacity sort keys */
+  int *scratch ;      /* Scratch for pb_sort_far_to_near(), capacity indices */
+} polygon_buffer_t ;
+
+
+void *pb_realloc(void *p, int n, size_t size) {
+
+  p = realloc(p,(size_t)n*size) ;
+  if (!p) {
+    error("POLYGONS.C: allocation failure") ;
+  }
+  return p ;
+}
+
+
+void pb_reserve(polygon_buffer_t *pb, int capacity) {
+
+  if (capacity <= pb->capacity) {
+    return ;
+  }
+  pb->x = (float *)pb_realloc(pb->x,POLY_MAX_VERTICES*capacity,sizeof(float)) ;
+  pb->y = (float *)pb_realloc(pb->y,POLY_MAX_VERTICES*capacity,sizeof(float)) ;
+  pb->z = (float *)pb_realloc(pb->z,POLY_MAX_VERTICES*capacity,sizeof(float)) ;
+  pb->vertices = (unsigned char *)pb_realloc(pb->vertices,capacity,sizeof(unsigned char)) ;
+  pb->depth = (float *)pb_realloc(pb->depth,capacity,sizeof(float)) ;
+  pb->nx = (float *)pb_realloc(pb->nx,6*capacity,sizeof(float)) ; /* ny..cz share the block */
+  pb->ny = pb->nx + capacity ;
+  pb->nz = pb->ny + capacity ;
+  pb->cx = pb->nz + capacity ;
+  pb->cy = pb->cx + capacity ;
+  pb->cz = pb->cy + capacity ;
+  pb->intensity = (float *)pb_realloc(pb->intensity,capacity,sizeof(float)) ;
+  pb->shade = (float *)pb_realloc(pb->shade,POLY_MAX_VERTICES*capacity,sizeof(float)) ;
+  pb->color = (pixel_t *)pb_realloc(pb->color,capacity,sizeof(pixel_t)) ;
+  pb->culled = (unsigned char *)pb_realloc(pb->culled,capacity,sizeof(unsigned char)) ;
+  pb->order = (int *)pb_realloc(pb->order,capacity,sizeof(int)) ;
+  pb->keys = (unsigned int *)pb_realloc(pb->keys,2*capacity,sizeof(unsigned int)) ;
+  pb->scratch = (int *)pb_realloc(pb->scratch,capacity,sizeof(int)) ;
+  pb->capacity = capacity ;
+}
+
+
+void pb_init(polygon_buffer_t *pb) {
+
+  memset(pb,0,sizeof(*pb)) ;
+}
+
+
+void pb_free(polygon_buffer_t *pb) {
+
+  free(pb->x) ;
+  free(pb->y) ;
+  free(pb->z) ;
+  free(pb->vertices) ;
+  free(pb->depth) ;
+  free(pb->nx) ;
+  free(pb->intensity) ;
+  free(pb->shade) ;
+  free(pb->color) ;
+  free(pb->culled) ;
+  free(pb->order) ;
+  free(pb->keys) ;
+  free(pb->scratch) ;
+  pb_init(pb) ;
+}
+
+
+/* Stores one polygon of n <= POLY_MAX_VERTICES vertices at index i, which
+   must be below the reserved capacity, with the vertex intensities in
+   shade[] if it is not NULL. Its intensity is left for the lighting pass. */
+
+void pb_store(polygon_buffer_t *pb, int i, vec4_t P[], float shade[], int n, float depth, vec4_t normal, vec4_t centroid, pixel_t color) {
+
+  int k ;
+
+  for (k = 0 ; k < n ; k++) {
+    pb->x[POLY_MAX_VERTICES*i + k] = (float)P[k].x ;
+    pb->y[POLY_MAX_VERTICES*i + k] = (float)P[k].y ;
+    pb->z[POLY_MAX_VERTICES*i + k] = (float)P[k].z ;
+    if (shade) pb->shade[POLY_MAX_VERTICES*i + k] = shade[k] ;
+  }
+  pb->vertices[i] = (unsigned char)n ;
+  pb->depth[i] = depth ;
+  pb->nx[i] = (float)normal.x ;
+  pb->ny[i] = (float)normal.y ;
+  pb->nz[i] = (float)normal.z ;
+  pb->cx[i] = (float)centroid.x ;
+  pb->cy[i] = (float)centroid.y ;
+  pb->cz[i] = (float)centroid.z ;
+  pb->color[i] = color ;
+  pb->culled[i] = CULL_NONE ;
+}
+
+
+/* Marks polygon i as not drawn, for the given reason */
+
+void pb_cull(polygon_buffer_t *pb, int i, int reason) {
+
+  pb->culled[i] = (unsigned char)reason ;
+}
+
+
+/* Gathers the vertices of polygon i into P[], the form the polygon fillers take, and returns how many there are */
+
+int pb_vertices(polygon_buffer_t *pb, int i, vec4_t P[]) {
+
+  int k, n = pb->vertices[i] ;
+
+  for (k = 0 ; k < n ; k++) {
+    P[k] = vec4_make(pb->x[POLY_MAX_VERTICES*i + k],pb->y[POLY_MAX_VERTICES*i + k],pb->z[POLY_MAX_VERTICES*i + k],1.0) ;
+  }
+  return n ;
+}
+
+
+/* Vertex intensities of polygon i, as the Gouraud fillers take them */
+
+float *pb_shades(polygon_buffer_t *pb, int i) {
+
+  return pb->shade + POLY_MAX_VERTICES*i ;
+}
+
+
+/* Lit colour of polygon i */
+
+pixel_t pb_shade(polygon_buffer_t *pb, int i) {
+
+  float I = pb->intensity[i] ;
+  pixel_t c = pb->color[i] ;
+
+  return FB_RGB(FB_RED(c)*I,FB_GREEN(c)*I,FB_BLUE(c)*I) ;
+}
+
+
+/* Lists the polygons that were not culled in order, by index, and adds up
+   the culled ones by reason in rejected[CULL_REASONS] */
+
+void pb_visible_order(polygon_buffer_t *pb, int rejected[]) {
+
+  int i ;
+
+  memset(rejected,0,CULL_REASONS*sizeof(int)) ;
+  for (pb->visible = 0, i = 0 ; i < pb->count ; i++) {
+    if (pb->culled[i] == CULL_NONE) {
+      pb->order[pb->visible++] = i ;
+    }
+    rejected[pb->culled[i]]++ ;
+  }
+}
+
+
+#define SORT_BITS 11 /* Radix digit, three passes cover a 32 bit key */
+#define SORT_BUCKETS (1 << SORT_BITS)
+#define SORT_PASSES 3
+
+/* Orders pb->order[0 .. pb->visible-1] by decreasing depth, far polygons
+   first, for the painter's algorithm. This is an LSD radix sort on the bits
+   of the float keys, so it is linear in the number of polygons, stable and
+   iterative, and only the indices move. Passes whose digit is the same for
+   every key are skipped. */
+
+void pb_sort_far_to_near(polygon_buffer_t *pb) {
+
+  static int count[SORT_PASSES][SORT_BUCKETS] ;
+  unsigned int *key = pb->keys, *key_out = pb->keys + pb->capacity, *kt, bits ;
+  int *index = pb->order, *index_out = pb->scratch, *it ;
+  int n = pb->visible, i, d, pass, shift, sum, t ;
+
+  memset(count,0,sizeof(count)) ;
+  for (i = 0 ; i < n ; i++) {
+    memcpy(&bits,&pb->depth[index[i]],sizeof(bits)) ;
+    bits = (bits & 0x80000000u) ? ~bits : bits | 0x80000000u ; /* Unsigned order now matches float order */
+    key[i] = ~bits ; /* Largest depth first */
+    for (pass = 0 ; pass < SORT_PASSES ; pass++) {
+      count[pass][(key[i] >> (pass*SORT_BITS)) & (SORT_BUCKETS - 1)]++ ;
+    }
+  }
+
+  for (pass = 0 ; pass < SORT_PASSES ; pass++) {
+    shift = pass*SORT_BITS ;
+    if (n == 0 || count[pass][(key[0] >> shift) & (SORT_BUCKETS - 1)] == n) {
+      continue ; /* Every key has the same digit, the order would not change */
+    }
+    for (sum = 0, d = 0 ; d < SORT_BUCKETS ; d++) { /* Counts become the first slot of each digit */
+      t = count[pass][d] ;
+      count[pass][d] = sum ;
+      sum += t ;
+    }
+    for (i = 0 ; i < n ; i++) {
+      t = count[pass][(key[i] >> shift) & (SORT_BUCKETS - 1)]++ ;
+      key_out[t] = key[i] ;
+      index_out[t] = index[i] ;
+    }
+    kt = key ; key = key_out ; key_out = kt ;
+    it = index ; index = index_out ; index_out = it ;
+  }
+  if (index != pb->order) {
+    memcpy(pb->order,index,(size_t)n*sizeof(int)) ;
+  }
+}
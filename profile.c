@@ -0,0 +1,137 @@
+/*            PURPOSE : Per-frame stage timers and counters
+
+        PREREQUISITES : matrix.h (build with -DNO_PROFILE to compile every probe away)
+
+*/
+
+#include <string.h>
+#include <time.h>
+
+enum { PROF_CAMERA, PROF_SPHERE, PROF_TORUS, PROF_CONE, PROF_LIGHTING, PROF_SORT, PROF_FILL, PROF_PRESENT, PROF_STAGES } ;
+enum { PROF_POLYGONS, PROF_CULLED_BACK, PROF_CULLED_FRUSTUM, PROF_PIXELS, PROF_ALLOCS, PROF_ARENA_PEAK, PROF_COUNTERS } ;
+enum { PROF_OFF, PROF_TEXT, PROF_JSON, PROF_CSV } ;
+
+const char *prof_stage_names[PROF_STAGES] = { "camera", "sphere", "torus", "cone", "lighting", "sort", "fill", "present" } ;
+const char *prof_counter_names[PROF_COUNTERS] = { "polygons", "culled_back", "culled_frustum", "pixels", "matrix_allocs", "matrix_arena_peak" } ;
+
+
+/* Monotonic wall clock in seconds */
+
+double prof_now(void) {
+
+#ifdef _WIN32
+  LARGE_INTEGER count, frequency ;
+
+  QueryPerformanceCounter(&count) ;
+  QueryPerformanceFrequency(&frequency) ;
+  return (double)count.QuadPart/(double)frequency.QuadPart ;
+#else
+  struct timespec t ;
+
+  clock_gettime(CLOCK_MONOTONIC,&t) ;
+  return t.tv_sec + t.tv_nsec*1e-9 ;
+#endif
+}
+
+
+#ifndef NO_PROFILE
+
+struct {
+  int format ;                 /* PROF_OFF, or how each frame is reported to stderr */
+  long frame ;                 /* Frames reported so far */
+  double frame_start ;
+  double start[PROF_STAGES] ;  /* When the running stage began */
+  double time[PROF_STAGES] ;   /* Seconds spent in each stage this frame */
+  int calls[PROF_STAGES] ;     /* Times each stage ran this frame */
+  long count[PROF_COUNTERS] ;
+  long allocs ;                /* dmat_allocations when the frame began */
+} profile ;
+
+
+void prof_frame_begin(void) {
+
+  memset(profile.time,0,sizeof(profile.time)) ;
+  memset(profile.calls,0,sizeof(profile.calls)) ;
+  memset(profile.count,0,sizeof(profile.count)) ;
+  profile.allocs = dmat_allocations ;
+  if (dmat_arena) dmat_arena->peak = dmat_arena->used ;
+  profile.frame_start = prof_now() ;
+}
+
+
+void prof_frame_end(void) {
+
+  double total = prof_now() - profile.frame_start ;
+  int i ;
+
+  profile.count[PROF_ALLOCS] = dmat_allocations - profile.allocs ;
+  profile.count[PROF_ARENA_PEAK] = dmat_arena ? (long)dmat_arena->peak : 0 ; /* Bytes */
+  if (profile.format == PROF_OFF) {
+    return ;
+  }
+  if (profile.format == PROF_CSV && profile.frame == 0) {
+    fprintf(stderr,"frame,total_ms") ;
+    for (i = 0 ; i < PROF_STAGES ; i++) fprintf(stderr,",%s_ms,%s_calls",prof_stage_names[i],prof_stage_names[i]) ;
+    for (i = 0 ; i < PROF_COUNTERS ; i++) fprintf(stderr,",%s",prof_counter_names[i]) ;
+    fprintf(stderr,"\n") ;
+  }
+  profile.frame++ ;
+
+  if (profile.format == PROF_JSON) {
+    fprintf(stderr,"{\"frame\":%ld,\"total_ms\":%.4f",profile.frame,1000.0*total) ;
+    for (i = 0 ; i < PROF_STAGES ; i++) fprintf(stderr,",\"%s_ms\":%.4f,\"%s_calls\":%d",prof_stage_names[i],1000.0*profile.time[i],prof_stage_names[i],profile.calls[i]) ;
+    for (i = 0 ; i < PROF_COUNTERS ; i++) fprintf(stderr,",\"%s\":%ld",prof_counter_names[i],profile.count[i]) ;
+    fprintf(stderr,"}\n") ;
+  }
+  else if (profile.format == PROF_CSV) {
+    fprintf(stderr,"%ld,%.4f",profile.frame,1000.0*total) ;
+    for (i = 0 ; i < PROF_STAGES ; i++) fprintf(stderr,",%.4f,%d",1000.0*profile.time[i],profile.calls[i]) ;
+    for (i = 0 ; i < PROF_COUNTERS ; i++) fprintf(stderr,",%ld",profile.count[i]) ;
+    fprintf(stderr,"\n") ;
+  }
+  else {
+    fprintf(stderr,"frame %ld: %.3f ms |",profile.frame,1000.0*total) ;
+    for (i = 0 ; i < PROF_STAGES ; i++) {
+      if (profile.calls[i]) fprintf(stderr," %s %.3f ms",prof_stage_names[i],1000.0*profile.time[i]) ;
+    }
+    fprintf(stderr," |") ;
+    for (i = 0 ; i < PROF_COUNTERS ; i++) fprintf(stderr," %s %ld",prof_counter_names[i],profile.count[i]) ;
+    fprintf(stderr,"\n") ;
+  }
+}
+
+/* Selects how frames are reported: "off", "text", "json" or "csv". Returns 0 for an unknown name. */
+
+int prof_set_format(const char *name) {
+
+  if (strcmp(name,"off") == 0) profile.format = PROF_OFF ;
+  else if (strcmp(name,"text") == 0) profile.format = PROF_TEXT ;
+  else if (strcmp(name,"json") == 0) profile.format = PROF_JSON ;
+  else if (strcmp(name,"csv") == 0) profile.format = PROF_CSV ;
+  else return 0 ;
+  return 1 ;
+}
+
+
+/* Probes, used from the thread that drives the frame */
+
+#define PROF_BEGIN(stage) (profile.start[stage] = prof_now())
+#define PROF_END(stage) (profile.time[stage] += prof_now() - profile.start[stage], profile.calls[stage]++)
+#define PROF_COUNT(counter,n) (profile.count[counter] += (n))
+#define PROF_FRAME_BEGIN() prof_frame_begin()
+#define PROF_FRAME_END() prof_frame_end()
+
+#else
+
+int prof_set_format(const char *name) {
+
+  return strcmp(name,"off") == 0 ; /* Nothing to report in this build */
+}
+
+#define PROF_BEGIN(stage) ((void)(stage)) /* Still evaluated, so a stage kept in a variable counts as used */
+#define PROF_END(stage) ((void)(stage))
+#define PROF_COUNT(counter,n) ((void)0)
+#define PROF_FRAME_BEGIN() ((void)0)
+#define PROF_FRAME_END() ((void)0)
+
+#endif
@@ -0,0 +1,164 @@
+/*            PURPOSE : Tile-binned rasterizer that fills the polygon buffer on the worker pool
+
+        PREREQUISITES : framebuffer.c, fillPoly.c, polygons.c, workers.c
+
+*/
+
+/* Each polygon is listed in every tile its bounding box touches, in draw
+   order, so a tile drawn on its own comes out exactly as it would in a
+   full-screen pass. Tiles never share pixels, so the workers need no locks. */
+
+typedef struct {
+  int tile_size ;     /* Width and height of a tile in pixels */
+  int cols, rows ;    /* Tile grid */
+  int *start ;        /* The polygons of tile t are index[start[t]] .. index[start[t+1]-1] */
+  int *index ;        /* Polygon indices, grouped by tile */
+  long *written ;     /* Pixels each tile drew in the last raster_draw() */
+  int tiles ;         /* Room in start, less one */
+  int capacity ;      /* Room in index */
+} tile_bins_t ;
+
+
+/* Tile range covered by polygon i, returns 0 if it is off the screen */
+
+int raster_tile_range(polygon_buffer_t *pb, int i, int w, int h, int tile_size, int *tx0, int *ty0, int *tx1, int *ty1) {
+
+  int k, x, y, x_min, x_max, y_min, y_max ;
+  float *xs = pb->x + POLY_MAX_VERTICES*i, *ys = pb->y + POLY_MAX_VERTICES*i ;
+
+  x_min = x_max = (int)xs[0] ;
+  y_min = y_max = (int)ys[0] ;
+  for (k = 1 ; k < pb->vertices[i] ; k++) { /* Same truncation as the fillers */
+    x = (int)xs[k] ;
+    y = (int)ys[k] ;
+    if (x < x_min) x_min = x ;
+    if (x > x_max) x_max = x ;
+    if (y < y_min) y_min = y ;
+    if (y > y_max) y_max = y ;
+  }
+  x_min-- ; /* The fillers' intersections can truncate one pixel left of the snapped vertices */
+  if (x_max < 0 || y_max < 0 || x_min >= w || y_min >= h) {
+    return 0 ;
+  }
+  *tx0 = (x_min < 0 ? 0 : x_min)/tile_size ;
+  *ty0 = (y_min < 0 ? 0 : y_min)/tile_size ;
+  *tx1 = (x_max >= w ? w - 1 : x_max)/tile_size ;
+  *ty1 = (y_max >= h ? h - 1 : y_max)/tile_size ;
+  return 1 ;
+}
+
+
+/* Sorts the pb->visible polygons listed in pb->order into tiles */
+
+void raster_bin(tile_bins_t *bins, polygon_buffer_t *pb, int w, int h, int tile_size) {
+
+  int i, k, t, tx, ty, tx0, ty0, tx1, ty1, total ;
+
+  bins->tile_size = tile_size ;
+  bins->cols = (w + tile_size - 1)/tile_size ;
+  bins->rows = (h + tile_size - 1)/tile_size ;
+  if (bins->cols*bins->rows > bins->tiles) {
+    bins->tiles = bins->cols*bins->rows ;
+    bins->start = (int *)pb_realloc(bins->start,bins->tiles + 1,sizeof(int)) ;
+    bins->written = (long *)pb_realloc(bins->written,bins->tiles,sizeof(long)) ;
+  }
+  memset(bins->start,0,(bins->cols*bins->rows + 1)*sizeof(int)) ;
+
+  for (k = 0 ; k < pb->visible ; k++) { /* Count the polygons in each tile, shifted by one */
+    if (raster_tile_range(pb,pb->order[k],w,h,tile_size,&tx0,&ty0,&tx1,&ty1)) {
+      for (ty = ty0 ; ty <= ty1 ; ty++) {
+        for (tx = tx0 ; tx <= tx1 ; tx++) {
+          bins->start[ty*bins->cols + tx + 1]++ ;
+        }
+      }
+    }
+  }
+  for (t = 0 ; t < bins->cols*bins->rows ; t++) { /* Running total gives where each tile ends */
+    bins->start[t + 1] += bins->start[t] ;
+  }
+  total = bins->start[bins->cols*bins->rows] ;
+  if (total > bins->capacity) {
+    bins->capacity = total ;
+    bins->index = (int *)pb_realloc(bins->index,total,sizeof(int)) ;
+  }
+
+  for (k = 0 ; k < pb->visible ; k++) { /* Second pass, start[t] is used as the write cursor of tile t */
+    i = pb->order[k] ;
+    if (raster_tile_range(pb,i,w,h,tile_size,&tx0,&ty0,&tx1,&ty1)) {
+      for (ty = ty0 ; ty <= ty1 ; ty++) {
+        for (tx = tx0 ; tx <= tx1 ; tx++) {
+          bins->index[bins->start[ty*bins->cols + tx]++] = i ;
+        }
+      }
+    }
+  }
+  for (t = bins->cols*bins->rows ; t > 0 ; t--) { /* The cursors now hold the ends, shift them back to starts */
+    bins->start[t] = bins->start[t - 1] ;
+  }
+  bins->start[0] = 0 ;
+}
+
+
+void raster_free(tile_bins_t *bins) {
+
+  free(bins->start) ;
+  free(bins->index) ;
+  free(bins->written) ;
+  memset(bins,0,sizeof(*bins)) ;
+}
+
+
+struct raster_job {
+  tile_bins_t *bins ;
+  framebuffer_t *fb ;
+  polygon_buffer_t *pb ;
+  fill_polygon_t fill ;
+  fill_gouraud_t gouraud ; /* Used instead of fill when set */
+} ;
+
+
+void raster_tile(void *arg, int t) {
+
+  struct raster_job *job = (struct raster_job *)arg ;
+  tile_bins_t *bins = job->bins ;
+  framebuffer_t tile = *job->fb ; /* Same pixels, clipped to this tile */
+  vec4_t P[POLY_MAX_VERTICES] ;
+  int k, i, n, x0, y0 ;
+
+  x0 = (t%bins->cols)*bins->tile_size ;
+  y0 = (t/bins->cols)*bins->tile_size ;
+  fb_set_clip(&tile,x0,y0,x0 + bins->tile_size,y0 + bins->tile_size) ;
+  tile.written = 0 ;
+
+  for (k = bins->start[t] ; k < bins->start[t + 1] ; k++) {
+    i = bins->index[k] ;
+    n = pb_vertices(job->pb,i,P) ;
+    if (job->gouraud) {
+      job->gouraud(&tile,job->pb->color[i],P,pb_shades(job->pb,i),n) ;
+    }
+    else {
+      job->fill(&tile,pb_shade(job->pb,i),P,n) ;
+    }
+  }
+  bins->written[t] = tile.written ; /* Each tile has its own slot, so no lock is needed */
+}
+
+
+/* Fills every binned polygon with fill, or with its vertex intensities by
+   gouraud if that is not NULL, one tile per worker task */
+
+void raster_draw(tile_bins_t *bins, framebuffer_t *fb, polygon_buffer_t *pb, fill_polygon_t fill, fill_gouraud_t gouraud) {
+
+  struct raster_job job ;
+  int t ;
+
+  job.bins = bins ;
+  job.fb = fb ;
+  job.pb = pb ;
+  job.fill = fill ;
+  job.gouraud = gouraud ;
+  workers_run(raster_tile,&job,bins->cols*bins->rows) ;
+  for (t = 0 ; t < bins->cols*bins->rows ; t++) {
+    fb->written += bins->written[t] ;
+  }
+}
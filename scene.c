@@ -0,0 +1,423 @@
+/*            PURPOSE : Scene descriptions: the camera, the lights and the parametric shapes to draw, built in or read from a file
+
+        PREREQUISITES : matrix.h, camera.c, framebuffer.c, polygons.c
+
+*/
+
+/* A scene file is read a line at a time. Everything after a # is a
+   comment, and each line starts with a keyword:
+
+     size <w> <h>                    image size in pixels
+     eye <x> <y> <z>                 centre of projection
+     gaze <x> <y> <z>                point looked at
+     up <x> <y> <z>                  up direction of the view
+     lens <near> <far> <fov>         depth mapping planes and vertical field of view in degrees
+     ambient <Ia>                    ambient light, 0 or more
+     light <x> <y> <z> [<Ls>]        a point light, of intensity 1 unless given, 0 or more
+     sphere|torus|cone [options]     a shape, with any of
+         steps <outer> <inner>       tessellation steps along each parameter, 1 to 2048
+         color <r> <g> <b>           unlit colour, 0 to 255
+         material <Pd> <Pa> <Ps>     diffuse, ambient and specular coefficients, 0 or more
+         at <x> <y> <z>              position of the origin of the shape
+         scale <s>                   uniform scale
+         rotate <x> <y> <z>          degrees about x, then y, then z
+
+   Anything not given keeps the value of the built-in scene, except that a
+   file starts with no lights and no shapes. */
+
+#include <string.h>
+
+#define Lx 3.0 //
+#define Ly 5.0 //  Light source coords
+#define Lz 3.0 //
+#define Ls 1.0 //Intensity of the light source
+
+#define Ia 0.5//Ambient light source
+
+#define Pd 0.50 //Coeff for diffuse light
+#define Pa 0.05 //Coeff for ambient light
+#define Ps 0.45 //Coeff for specular light
+
+#define SCENE_MAX_LIGHTS 8
+#define SCENE_MAX_SHAPES 32
+#define SCENE_MAX_STEPS 2048 /* Along each parameter, so the polygon buffer of SCENE_MAX_SHAPES shapes stays indexable by int */
+#define SCENE_LINE 512
+
+enum { SHAPE_SPHERE, SHAPE_TORUS, SHAPE_CONE, SHAPE_TYPES } ;
+
+const char *shape_names[SHAPE_TYPES] = { "sphere", "torus", "cone" } ;
+const int shape_default_steps[SHAPE_TYPES][2] = { { 230, 460 }, { 390, 390 }, { 500, 200 } } ; /* The steps of the original tessellation loops */
+const int shape_default_colors[SHAPE_TYPES][3] = { { 0, 255, 0 }, { 255, 0, 0 }, { 0, 255, 255 } } ;
+
+typedef struct {
+  vec4_t L ;        /* Position */
+  float intensity ; /* Ls */
+} light_t ;
+
+typedef struct {
+  int type ;          /* SHAPE_SPHERE, SHAPE_TORUS or SHAPE_CONE */
+  int steps[2] ;      /* Tessellation steps along the outer and inner parameter */
+  vec4_t at ;         /* Where the origin of the shape is placed */
+  double scale ;      /* Uniform scale about the origin of the shape */
+  double rotate[3] ;  /* Degrees about x, then y, then z */
+  pixel_t color ;     /* Unlit colour */
+  float diffuse, ambient, specular ; /* The coefficients Pd, Pa and Ps */
+} shape_t ;
+
+typedef struct {
+  vec4_t E ;  /* The centre of projection for the camera */
+  vec4_t G ;  /* Point gazed at by camera */
+  float ambient ; /* Ambient light, Ia */
+  int lights ;
+  light_t light[SCENE_MAX_LIGHTS] ;
+  int shapes ;
+  shape_t shape[SCENE_MAX_SHAPES] ;
+} scene_t ;
+
+
+/* Adds a shape of the given type with the default steps, colour and
+   material, at the origin. Returns NULL if the scene is full. */
+
+shape_t *scene_add_shape(scene_t *s, int type) {
+
+  shape_t *sh ;
+
+  if (s->shapes == SCENE_MAX_SHAPES) {
+    return NULL ;
+  }
+  sh = &s->shape[s->shapes++] ;
+  memset(sh,0,sizeof(*sh)) ;
+  sh->type = type ;
+  sh->steps[0] = shape_default_steps[type][0] ;
+  sh->steps[1] = shape_default_steps[type][1] ;
+  sh->at = vec4_make(0.0,0.0,0.0,1.0) ;
+  sh->scale = 1.0 ;
+  sh->color = FB_RGB(shape_default_colors[type][0],shape_default_colors[type][1],shape_default_colors[type][2]) ;
+  sh->diffuse = Pd ;
+  sh->ambient = Pa ;
+  sh->specular = Ps ;
+  return sh ;
+}
+
+
+/* The scene of the assignment: the sphere, torus and cone lit by one light */
+
+void scene_default(scene_t *s) {
+
+  memset(s,0,sizeof(*s)) ;
+  s->E = vec4_make(Ex,Ey,Ez,1.0) ;
+  s->G = vec4_make(Gx,Gy,Gz,1.0) ;
+  s->ambient = Ia ;
+  s->lights = 1 ;
+  s->light[0].L = vec4_make(Lx,Ly,Lz,1.0) ;
+  s->light[0].intensity = Ls ;
+  scene_add_shape(s,SHAPE_SPHERE) ;
+  scene_add_shape(s,SHAPE_TORUS) ;
+  scene_add_shape(s,SHAPE_CONE) ;
+}
+
+
+/* The model transform of a shape, world = M P. Its upper 3x3 is a rotation
+   times sh->scale, so normals transform by M and a division by the scale. */
+
+mat4_t shape_transform(const shape_t *sh) {
+
+  mat4_t M = mat4_identity(), R ;
+  double c, s ;
+  int i, j, k, a, b ;
+
+  for (k = 0 ; k < 3 ; k++) { /* Rotate about axis k, turning axis a towards axis b */
+    if (sh->rotate[k] == 0.0) {
+      continue ;
+    }
+    a = (k + 1)%3 ;
+    b = (k + 2)%3 ;
+    c = cos(M_PI/180.0*sh->rotate[k]) ;
+    s = sin(M_PI/180.0*sh->rotate[k]) ;
+    R = mat4_identity() ;
+    R.m[a][a] = c ;
+    R.m[a][b] = -s ;
+    R.m[b][a] = s ;
+    R.m[b][b] = c ;
+    M = mat4_mult(&R,&M) ;
+  }
+  for (i = 0 ; i < 3 ; i++) {
+    for (j = 0 ; j < 3 ; j++) {
+      M.m[i][j] *= sh->scale ;
+    }
+    M.m[i][3] = vec4_get(sh->at,i + 1) ;
+  }
+  return M ;
+}
+
+
+/* Reads the next n numbers of the line being split by strtok */
+
+int scene_numbers(double v[], int n) {
+
+  char *word, *end ;
+  int i ;
+
+  for (i = 0 ; i < n ; i++) {
+    word = strtok(NULL," \t\r\n") ;
+    if (!word) {
+      return 0 ;
+    }
+    v[i] = strtod(word,&end) ;
+    if (*end) {
+      return 0 ;
+    }
+  }
+  return 1 ;
+}
+
+
+/* Reads one shape line, the type has already been read */
+
+const char *scene_shape(shape_t *sh) {
+
+  char *word ;
+  double v[3] ;
+
+  while ((word = strtok(NULL," \t\r\n"))) {
+    if (strcmp(word,"steps") == 0) {
+      if (!scene_numbers(v,2) || v[0] < 1.0 || v[1] < 1.0 || v[0] > SCENE_MAX_STEPS || v[1] > SCENE_MAX_STEPS) return "steps takes two counts from 1 to 2048" ;
+      sh->steps[0] = (int)v[0] ;
+      sh->steps[1] = (int)v[1] ;
+    }
+    else if (strcmp(word,"color") == 0) {
+      if (!scene_numbers(v,3) || v[0] < 0.0 || v[0] > 255.0 || v[1] < 0.0 || v[1] > 255.0 || v[2] < 0.0 || v[2] > 255.0) return "color takes three values from 0 to 255" ;
+      sh->color = FB_RGB((int)v[0],(int)v[1],(int)v[2]) ;
+    }
+    else if (strcmp(word,"material") == 0) {
+      if (!scene_numbers(v,3) || v[0] < 0.0 || v[1] < 0.0 || v[2] < 0.0) return "material takes the diffuse, ambient and specular coefficients, each 0 or more" ;
+      sh->diffuse = (float)v[0] ;
+      sh->ambient = (float)v[1] ;
+      sh->specular = (float)v[2] ;
+    }
+    else if (strcmp(word,"at") == 0) {
+      if (!scene_numbers(v,3)) return "at takes x, y and z" ;
+      sh->at = vec4_make(v[0],v[1],v[2],1.0) ;
+    }
+    else if (strcmp(word,"scale") == 0) {
+      if (!scene_numbers(v,1) || v[0] <= 0.0) return "scale takes a factor above 0" ;
+      sh->scale = v[0] ;
+    }
+    else if (strcmp(word,"rotate") == 0) {
+      if (!scene_numbers(v,3)) return "rotate takes degrees about x, y and z" ;
+      sh->rotate[0] = v[0] ;
+      sh->rotate[1] = v[1] ;
+      sh->rotate[2] = v[2] ;
+    }
+    else {
+      return "unknown shape option" ;
+    }
+  }
+  return NULL ;
+}
+
+
+/* Reads one line into the scene and the camera. Returns NULL, or what is wrong with it. */
+
+const char *scene_line(scene_t *s, char *line) {
+
+  char *word = strtok(line," \t\r\n"), *end ;
+  double v[4] ;
+  int type ;
+
+  if (!word) {
+    return NULL ; /* Blank */
+  }
+  for (type = 0 ; type < SHAPE_TYPES ; type++) {
+    if (strcmp(word,shape_names[type]) == 0) {
+      shape_t *sh = scene_add_shape(s,type) ;
+
+      return sh ? scene_shape(sh) : "too many shapes" ;
+    }
+  }
+  if (strcmp(word,"size") == 0) {
+    if (!scene_numbers(v,2) || v[0] < 1.0 || v[1] < 1.0 || v[0] > 16384.0 || v[1] > 16384.0) return "size takes a width and height from 1 to 16384" ;
+    camera.w = (int)v[0] ;
+    camera.h = (int)v[1] ;
+  }
+  else if (strcmp(word,"eye") == 0) {
+    if (!scene_numbers(v,3)) return "eye takes x, y and z" ;
+    s->E = vec4_make(v[0],v[1],v[2],1.0) ;
+  }
+  else if (strcmp(word,"gaze") == 0) {
+    if (!scene_numbers(v,3)) return "gaze takes x, y and z" ;
+    s->G = vec4_make(v[0],v[1],v[2],1.0) ;
+  }
+  else if (strcmp(word,"up") == 0) {
+    if (!scene_numbers(v,3)) return "up takes x, y and z" ;
+    camera.up = vec4_make(v[0],v[1],v[2],0.0) ;
+  }
+  else if (strcmp(word,"lens") == 0) {
+    if (!scene_numbers(v,3) || v[0] <= 0.0 || v[1] <= v[0] || v[2] <= 0.0 || v[2] >= 180.0) return "lens takes near > 0, far > near and a field of view between 0 and 180 degrees" ;
+    camera.np = v[0] ;
+    camera.fp = v[1] ;
+    camera.theta = v[2] ;
+  }
+  else if (strcmp(word,"ambient") == 0) {
+    if (!scene_numbers(v,1) || v[0] < 0.0) return "ambient takes an intensity of 0 or more" ;
+    s->ambient = (float)v[0] ;
+  }
+  else if (strcmp(word,"light") == 0) {
+    if (!scene_numbers(v,3)) return "light takes x, y and z, and optionally an intensity" ;
+    if (s->lights == SCENE_MAX_LIGHTS) return "too many lights" ;
+    word = strtok(NULL," \t\r\n") ;
+    v[3] = word ? strtod(word,&end) : 1.0 ;
+    if ((word && *end) || v[3] < 0.0) return "the intensity of a light must be a number of 0 or more" ;
+    s->light[s->lights].L = vec4_make(v[0],v[1],v[2],1.0) ;
+    s->light[s->lights].intensity = (float)v[3] ;
+    s->lights++ ;
+  }
+  else {
+    return "unknown keyword" ;
+  }
+  if (strtok(NULL," \t\r\n")) {
+    return "too many values" ;
+  }
+  return NULL ;
+}
+
+
+/* Replaces s with the scene in filename, and the camera with its lens and
+   size. Reports the first error to stderr with its line number and
+   returns 0; s and the camera may then be partly read. */
+
+int scene_load(scene_t *s, const char *filename) {
+
+  FILE *f = fopen(filename,"r") ;
+  char line[SCENE_LINE], *comment ;
+  const char *problem = NULL ;
+  int n = 0 ;
+
+  if (!f) {
+    fprintf(stderr,"Could not open %s\n",filename) ;
+    return 0 ;
+  }
+  scene_default(s) ;
+  s->lights = 0 ;
+  s->shapes = 0 ;
+  while (!problem && fgets(line,sizeof(line),f)) {
+    n++ ;
+    if ((comment = strchr(line,'#'))) {
+      *comment = '\0' ;
+    }
+    problem = scene_line(s,line) ;
+  }
+  fclose(f) ;
+  if (problem) {
+    fprintf(stderr,"%s:%d: %s\n",filename,n,problem) ;
+    return 0 ;
+  }
+  return 1 ;
+}
+
+
+/* A camera path for batch rendering: the eye and gaze point of each frame */
+
+typedef struct {
+  int frames ;
+  vec4_t *E ;
+  vec4_t *G ;
+} camera_path_t ;
+
+
+void camera_path_alloc(camera_path_t *p, int frames) {
+
+  p->frames = frames ;
+  p->E = (vec4_t *)pb_realloc(NULL,frames,sizeof(vec4_t)) ;
+  p->G = (vec4_t *)pb_realloc(NULL,frames,sizeof(vec4_t)) ;
+}
+
+
+void camera_path_free(camera_path_t *p) {
+
+  free(p->E) ;
+  free(p->G) ;
+  p->E = p->G = NULL ;
+  p->frames = 0 ;
+}
+
+
+/* A turntable: the eye of s turned about the up direction of the camera,
+   through the gaze point, by degrees over the given number of frames. The
+   last frame stops one step short, so a full turn loops without a repeat. */
+
+void camera_path_orbit(camera_path_t *p, const scene_t *s, int frames, double degrees) {
+
+  vec4_t k = vec4_normalize(camera.up), v = vec4_sub(s->E,s->G), r ;
+  double a ;
+  int i ;
+
+  camera_path_alloc(p,frames) ;
+  for (i = 0 ; i < frames ; i++) { /* Rodrigues' rotation of v about k */
+    a = M_PI/180.0*degrees*i/frames ;
+    r = vec4_add(vec4_add(vec4_scalar_mult(v,cos(a)),vec4_scalar_mult(vec4_cross(k,v),sin(a))),vec4_scalar_mult(k,vec4_dot(k,v)*(1.0 - cos(a)))) ;
+    p->E[i] = vec4_add(s->G,r) ;
+    p->E[i].w = 1.0 ;
+    p->G[i] = s->G ;
+  }
+}
+
+
+/* Reads a path file, one frame a line as the eye x y z, optionally followed
+   by the gaze point x y z, which otherwise stays that of s. # starts a
+   comment. Reports the first error to stderr like scene_load. */
+
+int camera_path_load(camera_path_t *p, const scene_t *s, const char *filename) {
+
+  FILE *f = fopen(filename,"r") ;
+  char line[SCENE_LINE], *comment, *word ;
+  const char *problem = NULL ;
+  double v[6] ;
+  int n = 0, size = 16 ;
+
+  if (!f) {
+    fprintf(stderr,"Could not open %s\n",filename) ;
+    return 0 ;
+  }
+  camera_path_alloc(p,size) ;
+  p->frames = 0 ;
+  while (!problem && fgets(line,sizeof(line),f)) {
+    n++ ;
+    if ((comment = strchr(line,'#'))) {
+      *comment = '\0' ;
+    }
+    if (!(word = strtok(line," \t\r\n"))) {
+      continue ; /* Blank */
+    }
+    v[0] = strtod(word,&comment) ;
+    if (*comment || !scene_numbers(v + 1,2)) {
+      problem = "a frame takes the eye x, y and z, and optionally the gaze x, y and z" ;
+      break ;
+    }
+    if ((word = strtok(NULL," \t\r\n"))) {
+      v[3] = strtod(word,&comment) ;
+      if (*comment || !scene_numbers(v + 4,2) || strtok(NULL," \t\r\n")) {
+        problem = "a frame takes the eye x, y and z, and optionally the gaze x, y and z" ;
+        break ;
+      }
+    }
+    if (p->frames == size) {
+      size *= 2 ;
+      p->E = (vec4_t *)pb_realloc(p->E,size,sizeof(vec4_t)) ;
+      p->G = (vec4_t *)pb_realloc(p->G,size,sizeof(vec4_t)) ;
+    }
+    p->E[p->frames] = vec4_make(v[0],v[1],v[2],1.0) ;
+    p->G[p->frames] = word ? vec4_make(v[3],v[4],v[5],1.0) : s->G ;
+    p->frames++ ;
+  }
+  fclose(f) ;
+  if (!problem && p->frames == 0) {
+    problem = "no frames" ;
+  }
+  if (problem) {
+    fprintf(stderr,"%s:%d: %s\n",filename,n,problem) ;
+    camera_path_free(p) ;
+    return 0 ;
+  }
+  return 1 ;
+}
@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+#            PURPOSE : Renders every scene of scenes/golden and compares it with its reference image
+#
+#              USAGE : scenes/golden/check.sh [renderer [options...]]
+#
+# The renderer is the headless build, ./assignment3 by default. Each scene
+# is compared at the tolerance on its "# compare:" line. The options are
+# passed after those, so they can pick another filler or visibility mode
+# and loosen the tolerance to suit it, e.g.
+#
+#   scenes/golden/check.sh ./assignment3 -visibility zbuffer -tolerance 8 -max-pixels 200 -psnr 45
+#
+# Exits with 1 if any scene fails. The renders and the differences of the
+# failures are then left in the directory it names.
+
+dir=$(dirname "$0")
+renderer=${1:-./assignment3}
+[ $# -gt 0 ] && shift
+
+if [ ! -x "$renderer" ] ; then
+  echo "No renderer at $renderer, build it with: cc -O2 -o assignment3 zkucera_CompSci_Assignment3.c -lm -lpthread" >&2
+  exit 1
+fi
+
+out=$(mktemp -d) || exit 1
+failed=0
+total=0
+
+for scene in "$dir"/*.scene ; do
+  name=$(basename "$scene" .scene)
+  tolerance=$(sed -n 's/^# compare://p' "$scene")
+  total=$((total + 1))
+  # $tolerance is left unquoted so that it splits into separate options
+  if ! "$renderer" -scene "$scene" -compare "$dir/$name.ppm" $tolerance "$@" -diff "$out/${name}_diff.ppm" "$out/$name.ppm" > /dev/null ; then
+    echo "$name: FAIL" >&2
+    failed=$((failed + 1))
+  fi
+done
+
+if [ $failed -gt 0 ] ; then
+  echo "$failed of $total scenes failed, see $out" >&2
+  exit 1
+fi
+rm -rf "$out"
+echo "$total scenes match their references"
+exit 0
@@ -0,0 +1,109 @@
+/*            PURPOSE : Batch vertex transform by the camera matrix, with the perspective division fused in
+
+        PREREQUISITES : matrix.h (uses AVX or SSE when the compiler targets them, build with -DNO_SIMD for plain C)
+
+*/
+
+#if !defined(NO_SIMD) && defined(__AVX__)
+#include <immintrin.h>
+#define TRANSFORM_WIDTH 8
+#elif !defined(NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#include <xmmintrin.h>
+#define TRANSFORM_WIDTH 4
+#else
+#define TRANSFORM_WIDTH 1
+#endif
+
+
+/* One vertex at a time, for the tail of a batch and for builds without SIMD */
+
+void transform_points_scalar(const float c[4][4], const float *x, const float *y, const float *z, int n, float *sx, float *sy, float *sz, float *sw) {
+
+  float X, Y, Z, Wc, r ;
+  int i ;
+
+  for (i = 0 ; i < n ; i++) {
+    X = (c[0][0]*x[i] + c[0][1]*y[i]) + (c[0][2]*z[i] + c[0][3]) ; /* Summed in the same order as the SIMD lanes */
+    Y = (c[1][0]*x[i] + c[1][1]*y[i]) + (c[1][2]*z[i] + c[1][3]) ;
+    Z = (c[2][0]*x[i] + c[2][1]*y[i]) + (c[2][2]*z[i] + c[2][3]) ;
+    Wc = (c[3][0]*x[i] + c[3][1]*y[i]) + (c[3][2]*z[i] + c[3][3]) ;
+    r = 1.0f/Wc ;
+    sx[i] = X*r ;
+    sy[i] = Y*r ;
+    sz[i] = Z*r ;
+    sw[i] = Wc ;
+  }
+}
+
+
+/* Transforms the n points (x[i],y[i],z[i],1) by C and divides by w. sx, sy
+   and sz receive the screen coordinates and sw the clip-space w, so callers
+   can tell which points were behind the near plane; their screen
+   coordinates are not meaningful. Arrays need no particular alignment. */
+
+void transform_points(const mat4_t *C, const float *x, const float *y, const float *z, int n, float *sx, float *sy, float *sz, float *sw) {
+
+  float c[4][4] ;
+  int i = 0, j, k ;
+
+  for (j = 0 ; j < 4 ; j++) {
+    for (k = 0 ; k < 4 ; k++) {
+      c[j][k] = (float)C->m[j][k] ;
+    }
+  }
+
+#if TRANSFORM_WIDTH == 8
+  {
+    __m256 m[4][4], px, py, pz, X, Y, Z, Wc, r ;
+
+    for (j = 0 ; j < 4 ; j++) {
+      for (k = 0 ; k < 4 ; k++) {
+        m[j][k] = _mm256_set1_ps(c[j][k]) ;
+      }
+    }
+    for ( ; i + 8 <= n ; i += 8) {
+      px = _mm256_loadu_ps(x + i) ;
+      py = _mm256_loadu_ps(y + i) ;
+      pz = _mm256_loadu_ps(z + i) ;
+#define ROW(j) _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[j][0],px),_mm256_mul_ps(m[j][1],py)),_mm256_add_ps(_mm256_mul_ps(m[j][2],pz),m[j][3]))
+      X = ROW(0) ;
+      Y = ROW(1) ;
+      Z = ROW(2) ;
+      Wc = ROW(3) ;
+#undef ROW
+      r = _mm256_div_ps(_mm256_set1_ps(1.0f),Wc) ;
+      _mm256_storeu_ps(sx + i,_mm256_mul_ps(X,r)) ;
+      _mm256_storeu_ps(sy + i,_mm256_mul_ps(Y,r)) ;
+      _mm256_storeu_ps(sz + i,_mm256_mul_ps(Z,r)) ;
+      _mm256_storeu_ps(sw + i,Wc) ;
+    }
+  }
+#elif TRANSFORM_WIDTH == 4
+  {
+    __m128 m[4][4], px, py, pz, X, Y, Z, Wc, r ;
+
+    for (j = 0 ; j < 4 ; j++) {
+      for (k = 0 ; k < 4 ; k++) {
+        m[j][k] = _mm_set1_ps(c[j][k]) ;
+      }
+    }
+    for ( ; i + 4 <= n ; i += 4) {
+      px = _mm_loadu_ps(x + i) ;
+      py = _mm_loadu_ps(y + i) ;
+      pz = _mm_loadu_ps(z + i) ;
+#define ROW(j) _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[j][0],px),_mm_mul_ps(m[j][1],py)),_mm_add_ps(_mm_mul_ps(m[j][2],pz),m[j][3]))
+      X = ROW(0) ;
+      Y = ROW(1) ;
+      Z = ROW(2) ;
+      Wc = ROW(3) ;
+#undef ROW
+      r = _mm_div_ps(_mm_set1_ps(1.0f),Wc) ;
+      _mm_storeu_ps(sx + i,_mm_mul_ps(X,r)) ;
+      _mm_storeu_ps(sy + i,_mm_mul_ps(Y,r)) ;
+      _mm_storeu_ps(sz + i,_mm_mul_ps(Z,r)) ;
+      _mm_storeu_ps(sw + i,Wc) ;
+    }
+  }
+#endif
+  transform_points_scalar((const float (*)[4])c,x + i,y + i,z + i,n - i,sx + i,sy + i,sz + i,sw + i) ;
+}
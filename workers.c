@@ -0,0 +1,299 @@
+/*            PURPOSE : Fixed pool of worker threads that runs numbered tasks in parallel, and the queues between pipeline stages
+
+        PREREQUISITES : matrix.h, pthreads (build with -DNO_THREADS to run every task on the caller)
+
+*/
+
+#ifndef NO_THREADS
+#include <pthread.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define MAX_WORKERS 64
+
+typedef void (*task_fn_t)(void *arg, int task) ;
+
+/* A set of threads that runs one job at a time for the thread that owns
+   it. A pipeline gives each stage a pool of its own, so the stages never
+   wait for each other's jobs. */
+
+typedef struct {
+  int n ;             /* Threads taking part in a job, including the owner */
+#ifndef NO_THREADS
+  pthread_t threads[MAX_WORKERS] ;
+  pthread_mutex_t lock ;
+  pthread_cond_t start, done ;
+  task_fn_t fn ;      /* The job being run */
+  void *arg ;
+  int ntasks ;
+  int next ;          /* Next task to hand out */
+  int finished ;      /* Tasks completed so far */
+  int generation ;    /* Bumped for every job so sleeping workers notice it */
+  int quit ;
+#endif
+} worker_pool_t ;
+
+worker_pool_t worker_pool = { 1 } ; /* The pool of the main thread */
+
+#ifndef NO_THREADS
+_Thread_local worker_pool_t *worker_pool_current ; /* The pool workers_run() uses on this thread, NULL for worker_pool */
+#endif
+
+
+int workers_cpu_count(void) {
+
+  int n ;
+
+#ifdef _WIN32
+  SYSTEM_INFO info ;
+
+  GetSystemInfo(&info) ;
+  n = (int)info.dwNumberOfProcessors ;
+#else
+  n = (int)sysconf(_SC_NPROCESSORS_ONLN) ;
+#endif
+  return n < 1 ? 1 : n > MAX_WORKERS ? MAX_WORKERS : n ;
+}
+
+
+#ifndef NO_THREADS
+/* Takes tasks until the current job of pool runs dry. Called with its lock held. */
+
+void pool_drain(worker_pool_t *pool) {
+
+  task_fn_t fn ;
+  void *arg ;
+  int task ;
+
+  while (pool->next < pool->ntasks) {
+    task = pool->next++ ;
+    fn = pool->fn ;
+    arg = pool->arg ;
+    pthread_mutex_unlock(&pool->lock) ;
+    fn(arg,task) ;
+    pthread_mutex_lock(&pool->lock) ;
+    if (++pool->finished == pool->ntasks) {
+      pthread_cond_broadcast(&pool->done) ;
+    }
+  }
+}
+
+
+void *workers_main(void *arg) {
+
+  worker_pool_t *pool = (worker_pool_t *)arg ;
+  int generation = 0 ;
+
+  pthread_mutex_lock(&pool->lock) ;
+  for (;;) {
+    while (generation == pool->generation && !pool->quit) {
+      pthread_cond_wait(&pool->start,&pool->lock) ;
+    }
+    if (pool->quit) {
+      break ;
+    }
+    generation = pool->generation ;
+    pool_drain(pool) ;
+  }
+  pthread_mutex_unlock(&pool->lock) ;
+  return NULL ;
+}
+#endif
+
+
+/* Starts n - 1 worker threads for pool; the thread running its jobs is the n-th */
+
+void pool_start(worker_pool_t *pool, int n) {
+
+#ifndef NO_THREADS
+  int i ;
+
+  if (n > MAX_WORKERS) n = MAX_WORKERS ;
+  if (n <= 1 || pool->n > 1) {
+    return ;
+  }
+  pthread_mutex_init(&pool->lock,NULL) ;
+  pthread_cond_init(&pool->start,NULL) ;
+  pthread_cond_init(&pool->done,NULL) ;
+  pool->generation = 0 ;
+  pool->quit = 0 ;
+  for (i = 1 ; i < n ; i++) {
+    if (pthread_create(&pool->threads[i],NULL,workers_main,pool) != 0) {
+      error("WORKERS.C: could not create worker thread") ;
+    }
+  }
+  pool->n = n ;
+#endif
+}
+
+
+void pool_stop(worker_pool_t *pool) {
+
+#ifndef NO_THREADS
+  int i ;
+
+  if (pool->n <= 1) {
+    return ;
+  }
+  pthread_mutex_lock(&pool->lock) ;
+  pool->quit = 1 ;
+  pthread_cond_broadcast(&pool->start) ;
+  pthread_mutex_unlock(&pool->lock) ;
+  for (i = 1 ; i < pool->n ; i++) {
+    pthread_join(pool->threads[i],NULL) ;
+  }
+  pthread_mutex_destroy(&pool->lock) ;
+  pthread_cond_destroy(&pool->start) ;
+  pthread_cond_destroy(&pool->done) ;
+  pool->n = 1 ;
+#endif
+}
+
+
+/* Runs fn(arg,0) .. fn(arg,ntasks-1) across pool and returns once all of
+   them have finished. Only the thread that owns pool may call it, and
+   tasks must not start jobs of their own. */
+
+void pool_run(worker_pool_t *pool, task_fn_t fn, void *arg, int ntasks) {
+
+  int i ;
+
+  if (pool->n <= 1 || ntasks <= 1) {
+    for (i = 0 ; i < ntasks ; i++) {
+      fn(arg,i) ;
+    }
+    return ;
+  }
+#ifndef NO_THREADS
+  pthread_mutex_lock(&pool->lock) ;
+  pool->fn = fn ;
+  pool->arg = arg ;
+  pool->ntasks = ntasks ;
+  pool->next = 0 ;
+  pool->finished = 0 ;
+  pool->generation++ ;
+  pthread_cond_broadcast(&pool->start) ;
+  pool_drain(pool) ;
+  while (pool->finished < pool->ntasks) {
+    pthread_cond_wait(&pool->done,&pool->lock) ;
+  }
+  pthread_mutex_unlock(&pool->lock) ;
+#endif
+}
+
+
+/* The pool of the main thread, with the main thread as its n-th */
+
+void workers_start(int n) {
+
+  pool_start(&worker_pool,n) ;
+}
+
+
+void workers_stop(void) {
+
+  pool_stop(&worker_pool) ;
+}
+
+
+/* Makes workers_run() on the calling thread use pool, or worker_pool if NULL */
+
+void workers_use(worker_pool_t *pool) {
+
+#ifndef NO_THREADS
+  worker_pool_current = pool ;
+#endif
+}
+
+
+/* Runs a job on the calling thread's pool, see pool_run() */
+
+void workers_run(task_fn_t fn, void *arg, int ntasks) {
+
+#ifndef NO_THREADS
+  if (worker_pool_current) {
+    pool_run(worker_pool_current,fn,arg,ntasks) ;
+    return ;
+  }
+#endif
+  pool_run(&worker_pool,fn,arg,ntasks) ;
+}
+
+
+#ifndef NO_THREADS
+/* Bounded queue handing items from one pipeline stage to the next, each
+   stage on its own thread. queue_push() waits while the queue is full and
+   queue_pop() while it is empty, so a stage can run at most capacity items
+   ahead of the one after it. */
+
+#define QUEUE_CAPACITY 16
+
+typedef struct {
+  void *item[QUEUE_CAPACITY] ;
+  int capacity ;
+  int head, count ;   /* The items are item[head] .. item[head+count-1], wrapping around */
+  pthread_mutex_t lock ;
+  pthread_cond_t not_empty, not_full ;
+} work_queue_t ;
+
+
+void queue_init(work_queue_t *q, int capacity) {
+
+  q->capacity = capacity < 1 ? 1 : capacity > QUEUE_CAPACITY ? QUEUE_CAPACITY : capacity ;
+  q->head = q->count = 0 ;
+  pthread_mutex_init(&q->lock,NULL) ;
+  pthread_cond_init(&q->not_empty,NULL) ;
+  pthread_cond_init(&q->not_full,NULL) ;
+}
+
+
+void queue_destroy(work_queue_t *q) {
+
+  pthread_mutex_destroy(&q->lock) ;
+  pthread_cond_destroy(&q->not_empty) ;
+  pthread_cond_destroy(&q->not_full) ;
+}
+
+
+void queue_push(work_queue_t *q, void *item) {
+
+  pthread_mutex_lock(&q->lock) ;
+  while (q->count == q->capacity) {
+    pthread_cond_wait(&q->not_full,&q->lock) ;
+  }
+  q->item[(q->head + q->count++)%q->capacity] = item ;
+  pthread_cond_signal(&q->not_empty) ;
+  pthread_mutex_unlock(&q->lock) ;
+}
+
+
+void *queue_pop(work_queue_t *q) {
+
+  void *item ;
+
+  pthread_mutex_lock(&q->lock) ;
+  while (q->count == 0) {
+    pthread_cond_wait(&q->not_empty,&q->lock) ;
+  }
+  item = q->item[q->head] ;
+  q->head = (q->head + 1)%q->capacity ;
+  q->count-- ;
+  pthread_cond_signal(&q->not_full) ;
+  pthread_mutex_unlock(&q->lock) ;
+  return item ;
+}
+
+
+/* Runs fn(arg) on a thread of its own, for a pipeline stage */
+
+void stage_start(pthread_t *thread, void *(*fn)(void *), void *arg) {
+
+  if (pthread_create(thread,NULL,fn,arg) != 0) {
+    error("WORKERS.C: could not create stage thread") ;
+  }
+}
+#endif
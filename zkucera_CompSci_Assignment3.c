@@ -1,7 +1,46 @@
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include <math.h>
+#include <time.h>
 #include "camera.c"
+#include "transform.c"
+#include "lighting.c"
+#include "profile.c"
+#include "framebuffer.c"
 #include "fillPoly.c"
+#include "polygons.c"
+#include "mesh.c"
+#include "scene.c"
+#include "workers.c"
+#include "raster.c"
+
+framebuffer_t framebuffer; //The camera.w x camera.h pixel buffer that draw() renders into
+dmat_arena_t frameArena; //Holds the matrix temporaries of a frame, released when the frame is done
+#define FRAME_ARENA_SIZE (1 << 20)
+fill_polygon_t fillPolygon = XFillConvexPolygonSpans; //The polygon filler draw() uses, XFillConvexPolygon is the original scanline version
+
+#define VISIBILITY_PAINTER 0 //Sort polygons far to near and draw them in that order
+#define VISIBILITY_ZBUFFER 1 //Draw polygons in any order, resolving visibility per pixel with a depth buffer
+int visibility = VISIBILITY_PAINTER;
+
+int tileSize = 64; //Width and height of the screen tiles the polygons are binned into and filled in parallel, 0 fills them in one serial pass
+
+int culling = 1; //Drop polygons that face away from the camera or lie outside the view before they are lit
+#define BACKFACE_MARGIN 4.0 //Back faces estimated to lie fewer pixels than this inside the outline of their surface are kept, they cover the one pixel cracks the fillers leave along silhouettes
+
+#define SHADING_FLAT 0    //Light each polygon once at its centroid and fill it with one colour
+#define SHADING_GOURAUD 1 //Light the mesh vertices with the normals of the surface equations and blend the colour across each polygon
+int shading = SHADING_FLAT;
+
+//Adaptive tessellation. When lodError is more than 0, draw() works the parametric steps out from the size of each shape on screen instead of using the fixed steps of the scene.
+float lodError = 0.0; //Most a tessellated edge may stray from the true surface, in pixels
+int lodMin = 8;       //Fewest steps along any parameter
+int lodMax = 1024;    //Most steps along any parameter
+
+int reportCounts = 1; //Print the running polygon count after each shape is shaded
+
+#ifdef _WIN32
 const char g_szClassName[] = "myWindowClass";
 
 WNDCLASSEX wc;
@@ -9,337 +48,848 @@ MSG Msg;
 HWND hwnd;
 HDC hdc;
 PAINTSTRUCT ps;
+#endif
 
-#define Lx 3.0 //
-#define Ly 5.0 //  Light source coords
-#define Lz 3.0 //
-#define Ls 1.0 //Intensity of the light source
-
-#define Ia 0.5//Ambient light source
-
-#define Pd 0.50 //Coeff for diffuse light
-#define Pa 0.05 //Coeff for ambient light
-#define Ps 0.45 //Coeff for specular light
+scene_t scene; //The scene draw() renders, the built-in one or one read from a file. draw() compares it with the scene of the last frame to work out what has to be redone.
 
+//One quad as built by generateShapePolys, before it is stored into the polygon buffer and lit
 struct polygon {
-    dmatrix_t world_points[4];
-    dmatrix_t camera_points[4];
+    vec4_t camera_points[POLY_MAX_VERTICES];
+    int vertices;   //Number of camera points, more or less than 4 if the quad was clipped to the near plane
     int RED;
     int GREEN;
     int BLUE;
-    dmatrix_t normal;
-    dmatrix_t centroid;
-    dmatrix_t s;
-    dmatrix_t r;
-    dmatrix_t v;
-    double Id;
-    double Is;
+    vec4_t normal;
+    vec4_t centroid;
+    float shade[POLY_MAX_VERTICES]; //Light intensity at each camera point, for Gouraud shading
     float distanceFromCamera;
-}p;
+    int culled;     //CULL_NONE, or why the polygon was dropped before it was lit
+};
 
 
-//Module Name: swap
-//Author: https://www.geeksforgeeks.org/quick-sort/
-//Date: March 12th, 2019
-//Purpose: Used to swap two elements
-//Parameters: a,b: the two elements to be swapped
-void swap(struct polygon* a, struct polygon* b){ 
-    struct polygon t = *a; 
-    *a = *b; 
-    *b = t; 
-} 
-
-//Module Name: partition
-//Author: https://www.geeksforgeeks.org/quick-sort/
-//Date: March 12th, 2019
-//Purpose: Performs the "pivot" of quick sort
-//Parameters: arr[]: the array to be sorted, low: the lowest point of the sort, high: the max size of the array
-int partition (struct polygon arr[], int low, int high) { 
-    float pivot = arr[high].distanceFromCamera;    // pivot 
-    int i = (low - 1);  // Index of smaller element 
-  
-    for (int j = low; j <= high- 1; j++) 
-    { 
-        // If current element is smaller than or 
-        // equal to pivot 
-        if (arr[j].distanceFromCamera >= pivot) 
-        { 
-            i++;    // increment index of smaller element 
-            swap(&arr[i], &arr[j]); 
-        } 
-    } 
-    swap(&arr[i + 1], &arr[high]); 
-    return (i + 1); 
-} 
-
-//Module Name: quickSort
-//Author: https://www.geeksforgeeks.org/quick-sort/
-//Date: March 12th, 2019
-//Purpose: The main function used to quicksort our array of polygons
-//Parameters: arr[]: the array to be sorted, low: the lowest point of the sort, high: the max size of the array
-void quickSort(struct polygon arr[], int low, int high){ 
-    if (low < high) 
-    { 
-        /* pi is partitioning index, arr[p] is now 
-           at right place */
-        int pi = partition(arr, low, high); 
-  
-        // Separately sort elements before 
-        // partition and after partition 
-        quickSort(arr, low, pi - 1); 
-        quickSort(arr, pi + 1, high); 
-    } 
-} 
+//Module Name: hiddenBackFace
+//Purpose: Decides whether a quad that faces away from the camera can be culled without changing the frame. Along a silhouette the fillers leave pixels uncovered by the front faces, and the back faces just behind the outline show through there.
+//         How far those back faces reach is a distance on the screen, not an angle: on a thin tube seen at a grazing angle, faces well past edge-on still lie within a pixel of the outline.
+//         So the cosine between the surface normal and the direction to the camera is taken at every corner. It is zero on the outline, and its change along each projected edge gives its change per pixel.
+//         The quad is culled only when the nearest corner is at least BACKFACE_MARGIN pixels from the outline at that rate. Near the outline the cosine grows with the square root of the distance, which makes the estimate up to twice the true distance, hence the wide margin.
+//Parameters mesh: the mesh the quad belongs to, corner: the indices of its corners, E: The Camera position
+//Returns 1 if the quad lies far enough inside the outline to be culled
+int hiddenBackFace(mesh_t *mesh, int *corner, vec4_t E){
+    double f[POLY_VERTICES];//The cosine at each corner, negative where the surface faces away
+    double nearest = DBL_MAX, rate = 0.0;
+
+    for (int k = 0; k < POLY_VERTICES; k++){
+        int c = corner[k];
+        vec4_t v;
+
+        if (mesh->sw[c] < NEAR_LIMIT) return 0;//Behind the near plane the screen coordinates mean nothing
+        v = vec4_normalize(vec4_from_homogeneous(vec4_sub(E, mesh->world[c])));
+        f[k] = mesh->nx[c] * v.x + mesh->ny[c] * v.y + mesh->nz[c] * v.z;
+        if (f[k] >= 0.0) return 0;//The outline runs through the quad
+        nearest = fmin(nearest, -f[k]);
+    }
+    for (int k = 0; k < POLY_VERTICES; k++){
+        int a = corner[k], b = corner[(k + 1) % POLY_VERTICES];
+        double length = hypot(mesh->sx[a] - mesh->sx[b], mesh->sy[a] - mesh->sy[b]);
+
+        if (length > 0.0) rate = fmax(rate, fabs(f[k] - f[(k + 1) % POLY_VERTICES]) / length);
+        else if (f[k] != f[(k + 1) % POLY_VERTICES]) return 0;//Folded into a point on the screen, so there is no telling
+    }
+    return nearest > BACKFACE_MARGIN * rate;
+}
 
 //Module Name: generateShapePolys
 //Author: Zachary Kucera
 //Date: March 12th, 2019
-//Purpose: Uses the four points it recieves to create a polygon, and then calculates all the different light intensities, the normal, the distance from the camera, and sets the colour of the polygon.
-//Parameters P0,P1,P2,P3: The four points that form the polygon, L: The light source matrix, E: The Camera position, C: the camera matrix, R,G,B: the red,green and blue components of the polygon's color
-//Returns the fully constructed polygon
-struct polygon generateShapePolys(dmatrix_t P0,dmatrix_t P1,dmatrix_t P2,dmatrix_t P3, dmatrix_t L, dmatrix_t E, dmatrix_t C, int R, int G, int B){
-    dmatrix_t v1;
-    dmatrix_t v2;
-    
-    v1 = *dmat_sub(from_homogeneous(&P1), from_homogeneous(&P0));//
-    v2 = *dmat_sub(from_homogeneous(&P2), from_homogeneous(&P1));//Caclculate two vectors with the points
+//Purpose: Uses the four corners of a quad of a mesh to create a polygon, and then calculates the normal, the centroid and the distance from the camera, and sets the colour of the polygon. The corners have already been projected by projectMesh.
+//         The light intensities are worked out afterwards for whole batches of polygons by the lighting pass, lightRows.
+//         With a frustum, quads facing away from the camera or wholly outside the view are marked as culled straight after the normal is found, and are not lit. Back faces near the outline of their surface are kept, see hiddenBackFace.
+//         Quads that cross the near plane are clipped to it before the perspective division.
+//         For Gouraud shading the corners also take the intensities the mesh vertices were lit with.
+//Parameters mesh: the mesh the quad belongs to, q: the index of the quad, E: The Camera position, C: the camera matrix, frustum: the view to cull against, or NULL to keep every quad
+//Returns the polygon, ready to be lit
+struct polygon generateShapePolys(mesh_t *mesh, int q, vec4_t E, mat4_t *C, frustum_t *frustum){
+    struct polygon p;//Local, so the generators can call this from several threads at once
+    int *corner = mesh->index + POLY_VERTICES*q;
+    vec4_t P0 = mesh->world[corner[0]];//
+    vec4_t P1 = mesh->world[corner[1]];//  The world points of the quad, shared with its neighbours
+    vec4_t P2 = mesh->world[corner[2]];//
+    vec4_t P3 = mesh->world[corner[3]];//
+    vec4_t v1;
+    vec4_t v2;
 
-   
-    p.world_points[0] = P0; //
-    p.world_points[1] = P1; //  Create the polygon with the 4 world_points found above.
-    p.world_points[2] = P2; //  
-    p.world_points[3] = P3; //
+    v1 = vec4_sub(vec4_from_homogeneous(P1), vec4_from_homogeneous(P0));//
+    v2 = vec4_sub(vec4_from_homogeneous(P2), vec4_from_homogeneous(P1));//Caclculate two vectors with the points
 
-    p.centroid = *dmat_scalar_mult(dmat_add(&P0, dmat_add(&P1, dmat_add(&P2, &P3))),0.25); //Find the centroid of the polygon
 
-    p.normal = *dmat_normalize(dcross_product(&v1,&v2));//Find the normal of the poly and normalize it
-    p.s = *dmat_normalize(dmat_sub(&L, &p.centroid));//Find the s vector and normalize it
-    p.Id = (Ls*Pd)*max(0,((ddot_product(from_homogeneous(&p.s),&p.normal))/(dmat_norm(&p.s) * dmat_norm(&p.normal))));//Calculate the intensity of diffuse light for the polygon
-    
-    p.r = *dmat_normalize(dmat_add(dmat_scalar_mult(from_homogeneous(&p.s),-1), dmat_scalar_mult(&p.normal,(2*ddot_product(from_homogeneous(&p.s),&p.normal)/pow(dmat_norm(&p.normal),2)))));//Calculate the r vector and normalize it
-    p.v = *dmat_normalize(dmat_sub(&E, &p.centroid));//Calculate the v vector and normailize it
-    
-    p.Is = (Ls * Ps) * max(0,(ddot_product(&p.r,from_homogeneous(&p.v)))/(dmat_norm(&p.r) * dmat_norm(&p.v)));
+    p.centroid = vec4_scalar_mult(vec4_add(P0, vec4_add(P1, vec4_add(P2, P3))),0.25); //Find the centroid of the polygon
 
-    p.distanceFromCamera = dmat_norm(dmat_sub(from_homogeneous(&E), from_homogeneous(&p.centroid)));//Calculate the distance from the camera
-    p.camera_points[0] = *perspective_projection(dmat_mult(&C, &P0));//
-    p.camera_points[1] = *perspective_projection(dmat_mult(&C, &P1));//Convert each point from world coordinates to 2D screen coordinates
-    p.camera_points[2] = *perspective_projection(dmat_mult(&C, &P2));//
-    p.camera_points[3] = *perspective_projection(dmat_mult(&C, &P3));//
+    p.normal = vec4_normalize(vec4_cross(v1,v2));//Find the normal of the poly and normalize it
 
-    p.RED = R;
-    p.GREEN = G;
-    p.BLUE = B;
+    p.culled = CULL_NONE;
+    if (frustum) {
+        double radius = 0.0;//Radius of a sphere about the centroid that holds the whole quad
+
+        if (vec4_dot(p.normal, vec4_from_homogeneous(vec4_sub(E, p.centroid))) < 0.0 && hiddenBackFace(mesh, corner, E)){//The normals point out of the surfaces, so this quad faces away from the camera
+            p.culled = CULL_BACK;
+            return p;
+        }
+        for (int k = 0; k < POLY_VERTICES; k++){
+            radius = fmax(radius, vec4_norm(vec4_sub(mesh->world[corner[k]], p.centroid)));
+        }
+        if (frustum_cull_sphere(frustum, p.centroid, radius)){
+            p.culled = CULL_FRUSTUM;
+            return p;
+        }
+    }
+
+    int front = 0;//Corners in front of the near plane
+    for (int k = 0; k < POLY_VERTICES; k++){
+        front += mesh->sw[corner[k]] >= NEAR_LIMIT;
+    }
+    if (front == POLY_VERTICES){
+        for (int k = 0; k < POLY_VERTICES; k++){
+            int c = corner[k];
+
+            p.camera_points[k] = vec4_make(mesh->sx[c], mesh->sy[c], mesh->sz[c], 1.0);//The screen coordinates were worked out once per vertex
+            p.shade[k] = mesh->shade[c];
+        }
+        p.vertices = POLY_VERTICES;
+    }
+    else {
+        vec4_t clip[POLY_VERTICES];
+        float shade[POLY_VERTICES];
+
+        for (int k = 0; k < POLY_VERTICES; k++){
+            clip[k] = mat4_mult_vec4(C, mesh->world[corner[k]]);//Only these rare quads need the homogeneous coordinates
+            shade[k] = mesh->shade[corner[k]];
+        }
+        p.vertices = clip_near(clip, shade, POLY_VERTICES, p.camera_points, p.shade);
+        if (p.vertices == 0){//Wholly behind the near plane
+            p.culled = CULL_FRUSTUM;
+            return p;
+        }
+        for (int k = 0; k < p.vertices; k++){
+            p.camera_points[k] = vec4_perspective_projection(p.camera_points[k]);
+        }
+    }
+    p.distanceFromCamera = vec4_norm(vec4_sub(vec4_from_homogeneous(E), vec4_from_homogeneous(p.centroid)));//Calculate the distance from the camera
+
+    p.RED = FB_RED(mesh->color);
+    p.GREEN = FB_GREEN(mesh->color);
+    p.BLUE = FB_BLUE(mesh->color);
     
     return p;        
 }
 
-//Module Name: generateSpherePoints
-//Author: Zachary Kucera
-//Date: March 12th, 2019
-//Purpose: Uses the parametric equation of a cone to construct all of the polygons needed to draw a Sphere.
-//Parameters L: The light source matrix, E: The Camera position, C: the camera matrix, polygons: the array of polygons, count: the current number of polygons in polygons
-//Returns count, so we can use the updated count in the next function
-int generateSpherePoints(dmatrix_t L, dmatrix_t E, dmatrix_t C, struct polygon *polygons, int count){
-    dmatrix_t P0;
-    dmatrix_t P1;
-    dmatrix_t P2;
-    dmatrix_t P3;
-
-    dmat_alloc(&P0,4,1) ;
-    dmat_alloc(&P1,4,1) ;
-    dmat_alloc(&P2,4,1) ;
-    dmat_alloc(&P3,4,1) ;   
-    
-    static float dt = M_PI / 230;
-    for (float u = 0.0; u <= M_PI; u += dt){ //Iterate u from 0 to PI
-        for (float v = 0.0; v<= 2.0*M_PI + dt; v += dt){ //Iterate from v to 2PI
-            P0.m[1][1] = (sin(u) * cos(v));  //X 3D coordinate of the sphere
-            P0.m[2][1] = (sin(u) * sin(v));  //Y 3D coordinate of the sphere
-            P0.m[3][1] = cos(u);             //Z 3D coordinate of the sphere
-            P0.m[4][1] = 1.0;                //1 becuase parametric
-
-            P1.m[1][1] = (sin(u + dt) * cos(v));  //X 3D coordinate of the sphere
-            P1.m[2][1] = (sin(u + dt) * sin(v));  //Y 3D coordinate of the sphere
-            P1.m[3][1] = cos(u + dt);             //Z 3D coordinate of the sphere
-            P1.m[4][1] = 1.0;                //1 becuase parametric
-            
-            P2.m[1][1] = (sin(u + dt) * cos(v + dt));  //X 3D coordinate of the sphere
-            P2.m[2][1] = (sin(u + dt) * sin(v+ dt));  //Y 3D coordinate of the sphere
-            P2.m[3][1] = cos(u + dt);             //Z 3D coordinate of the sphere
-            P2.m[4][1] = 1.0;                //1 becuase parametric
-
-            P3.m[1][1] = (sin(u) * cos(v + dt));  //X 3D coordinate of the sphere
-            P3.m[2][1] = (sin(u) * sin(v + dt));  //Y 3D coordinate of the sphere
-            P3.m[3][1] = cos(u);             //Z 3D coordinate of the sphere
-            P3.m[4][1] = 1.0;                //1 becuase parametric
-        
-            polygons[count] = generateShapePolys(P0,P1,P2,P3,L,E,C, 0,255,0);
-            count ++;
-        }
-    }
-    return count;
-}
-
-//Module Name: generateTorusPoints
-//Author: Zachary Kucera
-//Date: March 12th, 2019
-//Purpose: Uses the parametric equation of a cone to construct all of the polygons needed to draw a torus.
-//Parameters L: The light source matrix, E: The Camera position, C: the camera matrix, polygons: the array of polygons, count: the current number of polygons in polygons
-//Returns count, so we can use the updated count in the next function
-int generateTorusPoints(dmatrix_t L, dmatrix_t E, dmatrix_t C, struct polygon *polygons, int count){
-    dmatrix_t P0;
-    dmatrix_t P1;
-    dmatrix_t P2;
-    dmatrix_t P3;
+//Module Name: storePolygon
+//Purpose: Copies the parts of a polygon that are needed for lighting and drawing into the polygon buffer. Culled polygons are only marked as such.
+//Parameters polygons: the polygon buffer, i: the index to store the polygon at, poly: the polygon from generateShapePolys
+void storePolygon(polygon_buffer_t *polygons, int i, struct polygon poly){
+    if (poly.culled != CULL_NONE) {
+        pb_cull(polygons, i, poly.culled);//Only the reason is kept, the rest of the polygon was never worked out
+        return;
+    }
 
-    dmat_alloc(&P0,4,1) ;
-    dmat_alloc(&P1,4,1) ;
-    dmat_alloc(&P2,4,1) ;
-    dmat_alloc(&P3,4,1) ;   
+    pb_store(polygons, i, poly.camera_points, shading == SHADING_GOURAUD ? poly.shade : NULL, poly.vertices, poly.distanceFromCamera, poly.normal, poly.centroid, FB_RGB(poly.RED, poly.GREEN, poly.BLUE));
+}
 
-    float c = 3;    //How big the hole in the middle of the torus is
-    float a = 0.7;  //Radius of the tube
-    static float dt = M_PI / 195;
+//Module Name: parametricSteps
+//Purpose: Counts the iterations of a tessellation loop, for (float t = 0.0; t <= end; t += step), and the parameter value of each one.
+//         The last quad is cut off at end rather than running a step past it, and an iteration that lands exactly on end is dropped, as its quads would have no size.
+//Parameters end: the last parameter value of the loop, step: the parametric step, values: if not NULL, receives the value of t on each iteration, and the far edge of the last quad
+//Returns the number of iterations
+int parametricSteps(double end, double step, float *values){
+    int n = 0;
+    float t, last = 0.0;
 
-    for (float u = 0.0; u <= 2.0*M_PI; u += dt){            //Iterate both u and v to 2PI
-        for (float v = 0.0; v<= 2.0*M_PI + dt; v += dt){    //
-            P0.m[1][1] = ((c + (a * cos(v))) * cos(u));//
-            P0.m[2][1] = ((c + (a * cos(v))) * sin(u));//Parametric Equation for a torus 
-            P0.m[3][1] = (a * sin(v));       
-            P0.m[4][1] = 1.0;
+    for (t = 0.0; t <= end; t += step){
+        if (values) values[n] = t;
+        last = t;
+        n++;
+    }
+    if (n > 1 && last >= end) n--;
+    if (values) values[n] = t < end ? t : end;
+    return n;
+}
 
-            P1.m[1][1] = ((c + (a * cos(v))) * cos(u + dt));//
-            P1.m[2][1] = ((c + (a * cos(v))) * sin(u + dt));//Parametric Equation for a torus 
-            P1.m[3][1] = (a * sin(v));       
-            P1.m[4][1] = 1.0;  
+//Module Name: generateMeshPoints
+//Purpose: Evaluates a parametric surface and its normal once at every point of its grid and builds the index buffer of its quads. Each quad covers one step of both parameters, as the original tessellation loops did.
+//         The points are placed in the world by a model transform, a rotation and uniform scale followed by a translation.
+//Parameters mesh: the mesh to fill, point: the parametric equation of the surface, normal: the unit outward normal of the surface, outerEnd/outerStep: the outer loop, innerEnd/innerStep: the inner loop, outerFirst: the corner order of the quads, see mesh_index_grid,
+//           M: the model transform, scale: its scale, color: the colour of the surface
+void generateMeshPoints(mesh_t *mesh, vec4_t (*point)(float, float), vec4_t (*normal)(float, float), double outerEnd, double outerStep, double innerEnd, double innerStep, int outerFirst, mat4_t *M, double scale, pixel_t color){
+    int rows = parametricSteps(outerEnd, outerStep, NULL) + 1;
+    int cols = parametricSteps(innerEnd, innerStep, NULL) + 1;
+    float *outer = (float *)malloc(rows * sizeof(float));
+    float *inner = (float *)malloc(cols * sizeof(float));
 
-            P2.m[1][1] = ((c + (a * cos(v + dt))) * cos(u + dt));//
-            P2.m[2][1] = ((c + (a * cos(v + dt))) * sin(u + dt));//Parametric Equation for a torus 
-            P2.m[3][1] = (a * sin(v + dt));       
-            P2.m[4][1] = 1.0;  
+    if (!outer || !inner) error("Could not allocate the tessellation parameters");
+    parametricSteps(outerEnd, outerStep, outer);
+    parametricSteps(innerEnd, innerStep, inner);
 
-            P3.m[1][1] = ((c + (a * cos(v + dt))) * cos(u));//
-            P3.m[2][1] = ((c + (a * cos(v + dt))) * sin(u));//Parametric Equation for a torus 
-            P3.m[3][1] = (a * sin(v + dt));       
-            P3.m[4][1] = 1.0; 
+    mesh_alloc(mesh, rows, cols);
+    for (int r = 0; r < rows; r++){
+        for (int c = 0; c < cols; c++){
+            vec4_t n = vec4_scalar_mult(mat4_mult_vec4(M, normal(outer[r], inner[c])), 1.0 / scale);//The rotation alone, as the scale is uniform
 
-            polygons[count] = generateShapePolys(P0,P1,P2,P3,L,E,C,255,0,0);
-            count ++;
+            mesh->world[r*cols + c] = mat4_mult_vec4(M, point(outer[r], inner[c]));
+            mesh->nx[r*cols + c] = (float)n.x;
+            mesh->ny[r*cols + c] = (float)n.y;
+            mesh->nz[r*cols + c] = (float)n.z;
         }
     }
-    return count;
+    mesh_pack(mesh);
+    mesh_index_grid(mesh, outerFirst);
+    mesh->color = color;
+
+    free(outer);
+    free(inner);
 }
 
-//Module Name: generateConePoints
-//Author: Zachary Kucera
-//Date: March 12th, 2019
-//Purpose: Uses the parametric equation of a cone to construct all of the polygons needed to draw a cone.
-//Parameters L: The light source matrix, E: The Camera position, C: the camera matrix, polygons: the array of polygons, count: the current number of polygons in polygons
+//Module Name: spherePoint
+//Purpose: The parametric equation of the sphere
+//Parameters u: from 0 to PI, v: from 0 to 2PI
+vec4_t spherePoint(float u, float v){
+    return vec4_make(sin(u) * cos(v),  //X 3D coordinate of the sphere
+                     sin(u) * sin(v),  //Y 3D coordinate of the sphere
+                     cos(u),           //Z 3D coordinate of the sphere
+                     1.0);             //1 becuase parametric
+}
+
+//Module Name: sphereNormal
+//Purpose: The unit outward normal of the sphere, which is the point itself as a direction
+//Parameters u: from 0 to PI, v: from 0 to 2PI
+vec4_t sphereNormal(float u, float v){
+    vec4_t n = spherePoint(u, v);
+
+    n.w = 0.0;//A direction, so the model transform does not move it
+    return n;
+}
+
+//Module Name: torusPoint
+//Purpose: The parametric equation of the torus
+//Parameters u: around the hole, from 0 to 2PI, v: around the tube, from 0 to 2PI
+#define TORUS_HOLE 3.0 //How big the hole in the middle of the torus is
+#define TORUS_TUBE 0.7 //Radius of the tube
+
+vec4_t torusPoint(float u, float v){
+    float c = TORUS_HOLE;
+    float a = TORUS_TUBE;
+
+    return vec4_make((c + (a * cos(v))) * cos(u),//
+                     (c + (a * cos(v))) * sin(u),//Parametric Equation for a torus 
+                     a * sin(v),
+                     1.0);
+}
+
+//Module Name: torusNormal
+//Purpose: The unit outward normal of the torus, pointing from the centre of the tube
+//Parameters u: around the hole, from 0 to 2PI, v: around the tube, from 0 to 2PI
+vec4_t torusNormal(float u, float v){
+    return vec4_make(cos(v) * cos(u),
+                     cos(v) * sin(u),
+                     sin(v),
+                     0.0);
+}
+
+//Module Name: conePoint
+//Purpose: The parametric equation of the cone
+//Parameters v: along the height, from 0 to 1, u: around the cone, from 0 to 2PI
+vec4_t conePoint(float v, float u){
+    return vec4_make((v-1.0) * cos(u),
+                     (v-1.0) * sin(u),//Parametric Equation for a cone 
+                     v + 1.1,
+                     1.0);
+}
+
+//Module Name: coneNormal
+//Purpose: The unit outward normal of the cone. The side slopes at 45 degrees, so the normal is the same all the way up, apex included.
+//Parameters v: along the height, from 0 to 1, u: around the cone, from 0 to 2PI
+vec4_t coneNormal(float v, float u){
+    return vec4_make(-cos(u) * M_SQRT1_2,
+                     -sin(u) * M_SQRT1_2,
+                     M_SQRT1_2,
+                     0.0);
+}
+
+//The parametric surfaces a scene can hold, indexed by shape type. The curvature radii and bounding spheres are for the unscaled shapes and drive the level of detail.
+struct surface {
+    const char *label;                  //How the tessellation report names the shape
+    vec4_t (*point)(float, float);      //The parametric equation, of the outer then the inner parameter
+    vec4_t (*normal)(float, float);     //The unit outward normal, of the same parameters
+    double outerEnd, innerEnd;          //The ranges of the parameters, both starting at 0
+    int closeInner;                     //Whether the inner loop runs one step further to close the seam, as the original loops of the sphere and torus did
+    int outerFirst;                     //The corner order of the quads, see mesh_index_grid
+    double outerRadius, innerRadius;    //Tightest radius of curvature along each parameter, 0 for a straight line
+    vec4_t centre;                      //A sphere about the whole shape
+    double bound;
+    int stage;                          //The profiler stage the shape is tessellated and projected in
+} surfaces[SHAPE_TYPES] = {
+    { "SPHERE", spherePoint, sphereNormal, M_PI, 2.0*M_PI, 1, 1, 1.0, 1.0, {0.0,0.0,0.0,1.0}, 1.0, PROF_SPHERE },
+    { "TORUS", torusPoint, torusNormal, 2.0*M_PI, 2.0*M_PI, 1, 1, TORUS_HOLE + TORUS_TUBE, TORUS_TUBE, {0.0,0.0,0.0,1.0}, TORUS_HOLE + TORUS_TUBE, PROF_TORUS },
+    { "CONE", conePoint, coneNormal, 1.0, 2.0*M_PI, 0, 0, 0.0, 1.0, {0.0,0.0,1.6,1.0}, 1.118033988749895, PROF_CONE },//Height straight up from the rim at z = 1.1 to the apex at z = 2.1, the bound is sqrt(1.25)
+};
+
+//Module Name: generateShapePoints
+//Purpose: Uses the parametric equation of a shape of the scene to build the shared vertex grid and quads needed to draw it, with the steps, placement and colour the scene gives it
+//Parameters mesh: the mesh to fill, shape: the shape
+void generateShapePoints(mesh_t *mesh, shape_t *shape){
+    struct surface *f = &surfaces[shape->type];
+    mat4_t M = shape_transform(shape);
+    double outerStep = f->outerEnd / shape->steps[0];
+    double innerStep = f->innerEnd / shape->steps[1];
+
+    generateMeshPoints(mesh, f->point, f->normal, f->outerEnd, outerStep, f->innerEnd + (f->closeInner ? innerStep : 0.0), innerStep, f->outerFirst, &M, shape->scale, shape->color);
+}
+
+#define ROWS_PER_TASK 8 //Rows of vertices or quads a worker handles per task
+
+//Everything a worker needs to project or shade part of one mesh
+struct shapeJob {
+    scene_t *scene;     //The lights
+    shape_t *shape;     //The material
+    vec4_t E;           //The camera position
+    mat4_t *C;          //The camera matrix
+    frustum_t *frustum; //The view to cull against, NULL when culling is off
+    mesh_t *mesh;
+    polygon_buffer_t *polygons;
+    int base;           //Index in polygons of the first quad of the mesh
+};
+
+//Module Name: projectRows
+//Purpose: Worker task that transforms and projects ROWS_PER_TASK rows of mesh vertices
+//Parameters arg: the shapeJob, task: which range of rows to project
+void projectRows(void *arg, int task){
+    struct shapeJob *job = arg;
+    int first = task * ROWS_PER_TASK;
+    int last = first + ROWS_PER_TASK < job->mesh->rows ? first + ROWS_PER_TASK : job->mesh->rows;
+
+    mesh_project(job->mesh, job->C, first, last);
+}
+
+//Module Name: lightBatch
+//Purpose: Lights a batch of points of one shape with every light of the scene, adding up the intensities. The ambient term is counted once, with the first light.
+//         The sum is held between 0 and 1, the range a colour channel can take: with several lights, or bright ones, a highlight would otherwise come out past 255 and wrap round to dark.
+//Parameters job: the shapeJob, n: the number of points, nx,ny,nz: their unit normals, cx,cy,cz: their positions, intensity: receives the light intensity of each point
+void lightBatch(struct shapeJob *job, int n, float *nx, float *ny, float *nz, float *cx, float *cy, float *cz, float *intensity){
+    scene_t *s = job->scene;
+    shape_t *sh = job->shape;
+    int lights = s->lights > 0 ? s->lights : 1;//Without lights the ambient term is still needed
+
+    for (int k = 0; k < lights; k++){
+        phong_t m = { s->lights > 0 ? s->light[k].intensity : 0.0, k == 0 ? s->ambient : 0.0, sh->diffuse, sh->ambient, sh->specular };
+
+        light_points(&m, s->lights > 0 ? s->light[k].L : job->E, job->E, n, nx, ny, nz, cx, cy, cz, intensity, k > 0);
+    }
+    for (int i = 0; i < n; i++){
+        if (intensity[i] > 1.0f) intensity[i] = 1.0f;
+        else if (intensity[i] < 0.0f) intensity[i] = 0.0f;
+    }
+}
+
+//Module Name: lightVertexRows
+//Purpose: Worker task that lights ROWS_PER_TASK rows of mesh vertices for Gouraud shading
+//Parameters arg: the shapeJob, task: which range of rows to light
+void lightVertexRows(void *arg, int task){
+    struct shapeJob *job = arg;
+    mesh_t *m = job->mesh;
+    int first = task * ROWS_PER_TASK * m->cols;
+    int last = first + ROWS_PER_TASK * m->cols < m->rows * m->cols ? first + ROWS_PER_TASK * m->cols : m->rows * m->cols;
+
+    lightBatch(job, last - first, m->nx + first, m->ny + first, m->nz + first, m->px + first, m->py + first, m->pz + first, m->shade + first);
+}
+
+//Module Name: quadRange
+//Purpose: Works out which quads of the mesh a row task covers
+//Parameters job: the shapeJob, task: which range of rows, first,last: receive the quads first .. last - 1
+void quadRange(struct shapeJob *job, int task, int *first, int *last){
+    int quadsPerRow = job->mesh->cols - 1;
+
+    *first = task * ROWS_PER_TASK * quadsPerRow;
+    *last = *first + ROWS_PER_TASK * quadsPerRow < job->mesh->quads ? *first + ROWS_PER_TASK * quadsPerRow : job->mesh->quads;
+}
+
+//Module Name: polygonRows
+//Purpose: Worker task that builds ROWS_PER_TASK rows of quads and stores them in the polygon buffer. Quad q has the fixed slot base + q, so the workers never share output.
+//Parameters arg: the shapeJob, task: which range of rows to build
+void polygonRows(void *arg, int task){
+    struct shapeJob *job = arg;
+    int first, last;
+
+    quadRange(job, task, &first, &last);
+    for (int q = first; q < last; q++){
+        storePolygon(job->polygons, job->base + q, generateShapePolys(job->mesh, q, job->E, job->C, job->frustum));
+    }
+}
+
+//Module Name: lightRows
+//Purpose: Worker task that lights ROWS_PER_TASK rows of stored quads in one batch. The intensities of culled quads come out meaningless and are never read.
+//Parameters arg: the shapeJob, task: which range of rows to light
+void lightRows(void *arg, int task){
+    struct shapeJob *job = arg;
+    polygon_buffer_t *pb = job->polygons;
+    int first, last;
+
+    quadRange(job, task, &first, &last);
+    first += job->base;
+    lightBatch(job, last + job->base - first, pb->nx + first, pb->ny + first, pb->nz + first, pb->cx + first, pb->cy + first, pb->cz + first, pb->intensity + first);
+}
+
+//Module Name: shadeMesh
+//Purpose: Projects every vertex of a mesh exactly once, adds its quads to the polygon buffer, and lights them. For Gouraud shading the vertices are lit instead, before the quads are built.
+//         Every pass is shared out to the worker pool by rows.
+//Parameters mesh: the mesh to draw, shape: the shape of the scene it was built from, stage: the profiler stage of the mesh, E: The Camera position, C: the camera matrix, frustum: the view to cull against or NULL, polygons: the polygon buffer, count: the current number of polygons in polygons
 //Returns count, so we can use the updated count in the next function
-int generateConePoints(dmatrix_t L, dmatrix_t E, dmatrix_t C, struct polygon *polygons, int count){
-    dmatrix_t P0;
-    dmatrix_t P1;
-    dmatrix_t P2;
-    dmatrix_t P3;
+int shadeMesh(mesh_t *mesh, shape_t *shape, int stage, vec4_t E, mat4_t *C, frustum_t *frustum, polygon_buffer_t *polygons, int count){
+    struct shapeJob job = { &scene, shape, E, C, frustum, mesh, polygons, count };
 
-    dmat_alloc(&P0,4,1) ;
-    dmat_alloc(&P1,4,1) ;
-    dmat_alloc(&P2,4,1) ;
-    dmat_alloc(&P3,4,1) ;   
+    int vertexTasks = (mesh->rows + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+    int quadTasks = (mesh->rows - 1 + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
 
-    static float dt = M_PI / 100;
-    static double dv = 0.002;
-    for (float v = 0.0; v<= 1.0; v += dv){            //Iterate both u and v to 2PI
-        for (float u = 0.0; u <= 2.0*M_PI; u += dt){    //
-            P0.m[1][1] = (v-1.0) * cos(u) ;
-            P0.m[2][1] = (v-1.0) * sin(u) ;//Parametric Equation for a cone 
-            P0.m[3][1] = v + 1.1;       
-            P0.m[4][1] = 1.0;
+    PROF_BEGIN(stage);
+    workers_run(projectRows, &job, vertexTasks);
+    PROF_END(stage);
+    if (shading == SHADING_GOURAUD) {
+        PROF_BEGIN(PROF_LIGHTING);
+        workers_run(lightVertexRows, &job, vertexTasks);
+        PROF_END(PROF_LIGHTING);
+    }
+    PROF_BEGIN(stage);
+    workers_run(polygonRows, &job, quadTasks);
+    PROF_END(stage);
+    if (shading == SHADING_FLAT) {
+        PROF_BEGIN(PROF_LIGHTING);
+        workers_run(lightRows, &job, quadTasks);
+        PROF_END(PROF_LIGHTING);
+    }
+    return count + mesh->quads;
+}
 
-            P1.m[1][1] = (v-1.0) * cos(u + dt);
-            P1.m[2][1] = (v-1.0) * sin(u + dt) ;//Parametric Equation for a cone 
-            P1.m[3][1] = v + 1.1;       
-            P1.m[4][1] = 1.0;
+//Module Name: sameTessellation
+//Purpose: Checks whether two scenes would produce the same meshes
+//Parameters a,b: the scenes to compare
+int sameTessellation(scene_t *a, scene_t *b){
+    if (a->shapes != b->shapes) return 0;
+    for (int i = 0; i < a->shapes; i++){
+        shape_t *p = &a->shape[i], *q = &b->shape[i];
 
-            P2.m[1][1] = (v -1.0 + dv) * cos(u + dt);
-            P2.m[2][1] = (v -1.0 + dv) * sin(u + dt);//Parametric Equation for a cone 
-            P2.m[3][1] = v + dv + 1.1;       
-            P2.m[4][1] = 1.0;
+        if (p->type != q->type || p->steps[0] != q->steps[0] || p->steps[1] != q->steps[1] || !vec4_equal(p->at, q->at) || p->scale != q->scale ||
+            p->rotate[0] != q->rotate[0] || p->rotate[1] != q->rotate[1] || p->rotate[2] != q->rotate[2] || p->color != q->color) return 0;
+    }
+    return 1;
+}
 
-            P3.m[1][1] = (v -1.0 + dv) * cos(u);
-            P3.m[2][1] = (v -1.0 + dv) * sin(u);//Parametric Equation for a cone 
-            P3.m[3][1] = v + dv + 1.1;       
-            P3.m[4][1] = 1.0;
+//Module Name: shapeScale
+//Purpose: Works out how many pixels one world unit of a shape covers on screen, where the shape comes closest to the camera
+//Parameters C: the camera matrix, frustum: the view volume, s: the scene, centre/radius: a sphere around the shape
+//Returns the pixels per unit, or 0 if the shape is out of view
+double shapeScale(mat4_t *C, frustum_t *frustum, scene_t *s, vec4_t centre, double radius){
+    if (frustum_cull_sphere(frustum, centre, radius)) return 0.0;
+    return projected_scale(C, s->E, s->G, centre, radius);
+}
 
-            polygons[count] = generateShapePolys(P0,P1,P2,P3,L,E,C,0,255,255);
-            count ++;
+//Module Name: chooseTessellation
+//Purpose: Sets the parametric steps of a scene from the size of each shape on screen, so that no edge strays more than lodError pixels from the true surface.
+//         Each step is the one the tightest curve along that parameter needs, shapes out of view get lodMin steps and straight lines, such as the sides of the cone, need no more than that.
+//Parameters s: the scene, whose camera picks the steps
+void chooseTessellation(scene_t *s){
+    mat4_t C = build_camera_matrix(s->E, s->G);
+    frustum_t frustum = build_frustum(s->E, s->G);
+
+    for (int i = 0; i < s->shapes; i++){
+        shape_t *shape = &s->shape[i];
+        struct surface *f = &surfaces[shape->type];
+        mat4_t M = shape_transform(shape);
+        double scale = shapeScale(&C, &frustum, s, mat4_mult_vec4(&M, f->centre), f->bound * shape->scale);
+
+        shape->steps[0] = mesh_lod_steps(f->outerEnd, f->outerRadius * shape->scale, scale, lodError, lodMin, lodMax);
+        shape->steps[1] = mesh_lod_steps(f->innerEnd, f->innerRadius * shape->scale, scale, lodError, lodMin, lodMax);
+    }
+}
+
+//Module Name: sameView
+//Purpose: Checks whether two scenes would light and project the meshes the same way
+//Parameters a,b: the scenes to compare, which have the same shapes
+int sameView(scene_t *a, scene_t *b){
+    if (!vec4_equal(a->E, b->E) || !vec4_equal(a->G, b->G) || a->ambient != b->ambient || a->lights != b->lights) return 0;
+    for (int k = 0; k < a->lights; k++){
+        if (!vec4_equal(a->light[k].L, b->light[k].L) || a->light[k].intensity != b->light[k].intensity) return 0;
+    }
+    for (int i = 0; i < a->shapes; i++){
+        shape_t *p = &a->shape[i], *q = &b->shape[i];
+
+        if (p->diffuse != q->diffuse || p->ambient != q->ambient || p->specular != q->specular) return 0;
+    }
+    return 1;
+}
+
+//Module Name: shadeScene
+//Purpose: Builds the camera matrix, then projects and lights every mesh into the polygon buffer
+//Parameters meshes: the mesh of each shape of the scene, polygons: the polygon buffer
+void shadeScene(mesh_t meshes[], polygon_buffer_t *polygons) {
+    mat4_t C ; /* The camera matrix */
+    frustum_t frustum ; /* The planes of the view, for culling */
+
+    PROF_BEGIN(PROF_CAMERA);
+    C = build_camera_matrix(scene.E,scene.G) ;
+    frustum = build_frustum(scene.E,scene.G) ;
+    PROF_END(PROF_CAMERA);
+
+    int count = 0;//Keeps track of how many polygons we have
+    int quads = 0;
+
+    for (int i = 0; i < scene.shapes; i++) quads += meshes[i].quads;
+    pb_reserve(polygons, quads);//Grow the buffer to fit the meshes, it is never shrunk
+
+    for (int i = 0; i < scene.shapes; i++){
+        struct surface *f = &surfaces[scene.shape[i].type];
+
+        count = shadeMesh(&meshes[i],&scene.shape[i],f->stage,scene.E,&C,culling ? &frustum : NULL, polygons, count);// This adds the polys of the shape to the array, returns count so we know how many polys we have
+        if (reportCounts) printf("\nPOST %s: %d", f->label, count);
+    }
+    polygons->count = count;
+}
+
+//Module Name: orderScene
+//Purpose: Lists the polygons that were not culled, and sorts them for the painter's algorithm if needed
+//Parameters polygons: the shaded polygons, rejected: receives how many polygons were culled for each reason
+void orderScene(polygon_buffer_t *polygons, int rejected[]) {
+    pb_visible_order(polygons, rejected);
+    if (visibility == VISIBILITY_PAINTER) {
+        PROF_BEGIN(PROF_SORT);
+        pb_sort_far_to_near(polygons);//Sort the polygons by distance from the camera
+        PROF_END(PROF_SORT);
+    }
+}
+
+//Module Name: fillScene
+//Purpose: Clears the framebuffer and calls the XFil functions to fill the polygons in the order orderScene left them in
+//Parameters fb: the framebuffer the frame is rendered into, polygons: the shaded polygons, rejected: how many polygons were culled for each reason, for the profiler
+void fillScene(framebuffer_t *fb, polygon_buffer_t *polygons, int rejected[]) {
+    fb_clear(fb, FB_WHITE);
+    fb->written = 0;
+
+    int count = polygons->visible;
+
+    fill_polygon_t fill = fillPolygon;//The filler for this visibility mode
+    fill_gouraud_t gouraud = shading == SHADING_GOURAUD ? XFillConvexPolygonGouraud : NULL;//The filler that blends the vertex intensities, if the polygons have them
+
+    if (visibility == VISIBILITY_ZBUFFER) {
+        fb_alloc_depth(fb);
+        fb_clear_depth(fb);
+        fill = XFillConvexPolygonDepth;
+        if (gouraud) gouraud = XFillConvexPolygonGouraudDepth;
+    }
+
+    PROF_BEGIN(PROF_FILL);
+    if (tileSize > 0) {
+        static tile_bins_t bins;//The per-tile polygon lists, kept between frames
+
+        raster_bin(&bins, polygons, fb->w, fb->h, tileSize);//Sort the polygons into screen tiles, keeping the draw order within each tile
+        raster_draw(&bins, fb, polygons, fill, gouraud);//Fill the tiles in parallel on the worker pool
+    }
+    else {
+        vec4_t P[POLY_MAX_VERTICES];//The screen-space vertices of the polygon being filled
+
+        for(int k = 0; k < count; k++){
+            int i = polygons->order[k];
+            int n = pb_vertices(polygons, i, P);
+
+            if (gouraud) gouraud(fb, polygons->color[i], P, pb_shades(polygons, i), n);
+            else fill(fb, pb_shade(polygons, i), P, n); //fill the polys, using thier I value to determine the intensity of the colour
         }
     }
-    return count;
+    PROF_END(PROF_FILL);
+    PROF_COUNT(PROF_POLYGONS, count);
+    PROF_COUNT(PROF_CULLED_BACK, rejected[CULL_BACK]);
+    PROF_COUNT(PROF_CULLED_FRUSTUM, rejected[CULL_FRUSTUM]);
+    PROF_COUNT(PROF_PIXELS, fb->written);
 }
 
+//Module Name: buildMeshes
+//Purpose: Keeps the world-space mesh of every shape of the scene, and rebuilds them only when the tessellation has changed since they were built
+//Parameters rebuilt: set to 1 if the meshes had to be rebuilt
+//Returns the mesh of each shape
+mesh_t *buildMeshes(int *rebuilt) {
+    static mesh_t meshes[SCENE_MAX_SHAPES]; //The world-space mesh of each shape, kept between frames
+    static scene_t built; //The scene the meshes were made from
+    static int haveMeshes;
 
+    *rebuilt = !haveMeshes || !sameTessellation(&built, &scene);
+    if (*rebuilt) {
+        for (int i = 0; i < scene.shapes; i++){
+            int stage = surfaces[scene.shape[i].type].stage;
+
+            PROF_BEGIN(stage);
+            generateShapePoints(&meshes[i], &scene.shape[i]);
+            PROF_END(stage);
+        }
+        built = scene;
+        haveMeshes = 1;
+    }
+    return meshes;
+}
 
 //Module Name: Draw
 //Author: Zachary Kucera
 //Date: March 12th, 2019
-//Purpose: The primary function called to draw the shapes. Defines our camera, sorts polygons, and calls the XFil function to fill the polygons
-void draw() {
-    hdc = GetDC(hwnd);
+//Purpose: The primary function called to draw the shapes. Only redoes the work the changes since the last frame call for: the meshes are rebuilt when the tessellation changes,
+//         the polygons are re-projected and re-lit when the camera or light moves, and the polygons are re-filled when anything, including the render settings, changes.
+//Parameters fb: the framebuffer the frame is rendered into
+//Returns 1 if the frame was rendered, 0 if fb already held it
+int draw(framebuffer_t *fb) {
+    static polygon_buffer_t polygons; //The structure-of-arrays store of all of the polygons for the various shapes, kept between frames
+    static scene_t lit; //The scene the polygons were made from
+    static int havePolygons, haveFrame;
+    static int litCulling, litShading; //Whether the polygons were culled, and how they were shaded, when they were lit
+    static int drawnVisibility, drawnTileSize; //The render settings of the last frame
+    static fill_polygon_t drawnFill;
+    static pixel_t *drawnPixels;
 
-    dmatrix_t E ; /* The centre of projection for the camera */
-    
-    dmat_alloc(&E,4,1) ;
-    
-    E.m[1][1] = Ex ;
-    E.m[2][1] = Ey ;
-    E.m[3][1] = Ez ;
-    E.m[4][1] = 1.0 ;
-    
-    dmatrix_t G ; /* Point gazed at by camera */
-    
-    dmat_alloc(&G,4,1) ;
-    
-    G.m[1][1] = Gx ;
-    G.m[2][1] = Gy ;
-    G.m[3][1] = Gz ;
-    G.m[4][1] = 1.0 ;
+    if (lodError > 0.0) chooseTessellation(&scene);//The steps follow the camera
 
-    dmatrix_t C ; /* The camera matrix */
+    int rebuilt;
+    mesh_t *meshes = buildMeshes(&rebuilt);
+    int rejected[CULL_REASONS];//How many polygons were culled for each reason
+    int polygonsValid = !rebuilt && havePolygons && sameView(&lit, &scene) && litCulling == culling && litShading == shading;
 
-    dmat_alloc(&C,4,4) ;
-    C = *build_camera_matrix(&E,&G) ;
+    if (polygonsValid && haveFrame && drawnPixels == fb->pixels && drawnVisibility == visibility && drawnFill == fillPolygon && drawnTileSize == tileSize) {
+        return 0;//Nothing has changed, the framebuffer still holds this frame
+    }
 
-    /* The light source matrix*/
-    dmatrix_t L;
-    dmat_alloc(&L,4,1);
-    L.m[1][1] = Lx ;
-    L.m[2][1] = Ly ;
-    L.m[3][1] = Lz ;
-    L.m[4][1] = 1.0;  
+    if (!polygonsValid) {
+        shadeScene(meshes, &polygons);
+        lit = scene;
+        litCulling = culling;
+        litShading = shading;
+        havePolygons = 1;
+    }
+    orderScene(&polygons, rejected);
+    fillScene(fb, &polygons, rejected);
 
-    static struct polygon polygons[359412]; //The array that contains all of the polygons for the various shapes
-    int count = 0;//Keeps track of how many polygons we have
+    drawnPixels = fb->pixels;
+    drawnVisibility = visibility;
+    drawnFill = fillPolygon;
+    drawnTileSize = tileSize;
+    haveFrame = 1;
+    return 1;
+}
+//Command line settings that are not kept in the renderer's own globals
+struct options {
+    const char *filename;   //The image the headless build writes
+    int threads;
+    int repaints;
+    double coarsen;
+    const char *pathFile;   //The camera path of batch mode, a file or an orbit
+    int orbitFrames;
+    double orbitDegrees;
+    int pipelined;
+    int profiling;
+    const char *reference;  //What the frame is compared against, if anything
+    const char *diffFile;
+    int tolerance;
+    long maxPixels;
+    double minPsnr;
+    const char *headless;   //The first option given that only the headless build acts on, or NULL
+    char error[256];        //Why the command line was refused
+};
 
-    count = generateSpherePoints(L,E,C, polygons, count);// This adds the sphere polys to the array, returns count so we know how many polys we have
-    printf("\nPOST SPHERE: %d", count);
+//Module Name: parseOptions
+//Purpose: Reads the command line shared by WinMain and the headless main, see main for the options. The renderer's settings are set directly, the rest go into o.
+//         The scene is read as soon as -scene is met, and its steps are coarsened once every option is in, whichever order they came in.
+//Parameters argc/argv: the command line, argv[0] being the program, o: receives the settings
+//Returns 0 if an option is wrong, with the reason in o->error
+int parseOptions(int argc, char *argv[], struct options *o){
+    memset(o, 0, sizeof(*o));
+    o->filename = "render.ppm";
+    o->threads = workers_cpu_count();
+    o->coarsen = 1.0;
+    o->orbitDegrees = 360.0;
 
-    count = generateTorusPoints(L,E,C, polygons, count);// This adds the torus polys to the array, returns count so we know how many polys we have
-    printf("\nPOST TORUS: %d", count);
+    scene_default(&scene);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-scene") == 0 && i + 1 < argc) {
+            if (!scene_load(&scene, argv[++i])) {
+                snprintf(o->error, sizeof(o->error), "Could not read the scene file %s", argv[i]);
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "-fill") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "span") == 0) fillPolygon = XFillConvexPolygonSpans;
+            else if (strcmp(argv[i], "scanline") == 0) fillPolygon = XFillConvexPolygon;
+            else {
+                snprintf(o->error, sizeof(o->error), "Unknown filler %s, expected span or scanline", argv[i]);
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "-visibility") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "painter") == 0) visibility = VISIBILITY_PAINTER;
+            else if (strcmp(argv[i], "zbuffer") == 0) visibility = VISIBILITY_ZBUFFER;
+            else {
+                snprintf(o->error, sizeof(o->error), "Unknown visibility mode %s, expected painter or zbuffer", argv[i]);
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            o->threads = atoi(argv[++i]);
+            if (o->threads < 1) {
+                snprintf(o->error, sizeof(o->error), "The thread count must be at least 1");
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "-tiles") == 0 && i + 1 < argc) {
+            tileSize = atoi(argv[++i]);
+            if (tileSize < 0) {
+                snprintf(o->error, sizeof(o->error), "The tile size must be 0 (no tiling) or more");
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "-repaint") == 0 && i + 1 < argc) {
+            if (!o->headless) o->headless = argv[i];
+            o->repaints = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-cull") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "on") == 0) culling = 1;
+            else if (strcmp(argv[i], "off") == 0) culling = 0;
+            else {
+                snprintf(o->error, sizeof(o->error), "Unknown culling setting %s, expected on or off", argv[i]);
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "-shading") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "flat") == 0) shading = SHADING_FLAT;
+            else if (strcmp(argv[i], "gouraud") == 0) shading = SHADING_GOURAUD;
+            else {
+                snprintf(o->error, sizeof(o->error), "Unknown shading mode %s, expected flat or gouraud", argv[i]);
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "-coarsen") == 0 && i + 1 < argc) {
+            o->coarsen = atof(argv[++i]);
+            if (o->coarsen <= 0.0) {
+                snprintf(o->error, sizeof(o->error), "The coarsening factor must be more than 0");
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "-lod") == 0 && i + 1 < argc) {
+            lodError = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-lod-min") == 0 && i + 1 < argc) {
+            lodMin = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-lod-max") == 0 && i + 1 < argc) {
+            lodMax = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-orbit") == 0 && i + 1 < argc) {
+            if (!o->headless) o->headless = argv[i];
+            o->orbitFrames = atoi(argv[++i]);
+            if (o->orbitFrames < 1) {
+                snprintf(o->error, sizeof(o->error), "An orbit needs at least 1 frame");
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "-orbit-degrees") == 0 && i + 1 < argc) {
+            if (!o->headless) o->headless = argv[i];
+            o->orbitDegrees = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-path") == 0 && i + 1 < argc) {
+            if (!o->headless) o->headless = argv[i];
+            o->pathFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "-pipeline") == 0 && i + 1 < argc) {
+            if (!o->headless) o->headless = argv[i];
+            i++;
+            if (strcmp(argv[i], "on") == 0) o->pipelined = 1;
+            else if (strcmp(argv[i], "off") == 0) o->pipelined = 0;
+            else {
+                snprintf(o->error, sizeof(o->error), "Unknown pipeline setting %s, expected on or off", argv[i]);
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "-compare") == 0 && i + 1 < argc) {
+            if (!o->headless) o->headless = argv[i];
+            o->reference = argv[++i];
+        }
+        else if (strcmp(argv[i], "-tolerance") == 0 && i + 1 < argc) {
+            if (!o->headless) o->headless = argv[i];
+            o->tolerance = atoi(argv[++i]);
+            if (o->tolerance < 0 || o->tolerance > 255) {
+                snprintf(o->error, sizeof(o->error), "The tolerance is a channel difference from 0 to 255");
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "-max-pixels") == 0 && i + 1 < argc) {
+            if (!o->headless) o->headless = argv[i];
+            o->maxPixels = atol(argv[++i]);
+            if (o->maxPixels < 0) {
+                snprintf(o->error, sizeof(o->error), "The number of pixels allowed off must not be negative");
+                return 0;
+            }
+        }
+        else if (strcmp(argv[i], "-psnr") == 0 && i + 1 < argc) {
+            if (!o->headless) o->headless = argv[i];
+            o->minPsnr = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-diff") == 0 && i + 1 < argc) {
+            if (!o->headless) o->headless = argv[i];
+            o->diffFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "-profile") == 0 && i + 1 < argc) {
+            i++;
+            o->profiling = strcmp(argv[i], "off") != 0;
+            if (!prof_set_format(argv[i])) {
+                snprintf(o->error, sizeof(o->error), "Unknown profile format %s, expected off, text, json or csv (and a build without NO_PROFILE)", argv[i]);
+                return 0;
+            }
+        }
+        else {
+            if (!o->headless) o->headless = argv[i];
+            o->filename = argv[i];
+        }
+    }
+    if (lodMin < 1 || lodMax < lodMin || lodMax > SCENE_MAX_STEPS) {
+        snprintf(o->error, sizeof(o->error), "The level of detail range must have 1 <= lod-min <= lod-max <= %d", SCENE_MAX_STEPS);
+        return 0;
+    }
+    for (int i = 0; i < scene.shapes; i++){//After the scene is read, whichever order the options came in
+        for (int k = 0; k < 2; k++){
+            if (scene.shape[i].steps[k] / o->coarsen > SCENE_MAX_STEPS) {
+                snprintf(o->error, sizeof(o->error), "Coarsening by %g takes a shape past %d steps", o->coarsen, SCENE_MAX_STEPS);
+                return 0;
+            }
+            scene.shape[i].steps[k] = (int)ceil(scene.shape[i].steps[k] / o->coarsen);
+        }
+    }
+    return 1;
+}
 
-    count = generateConePoints(L,E,C, polygons, count);// This adds the sphere cone to the array, returns count so we know how many polys we have
-    printf("\nPOST CONE: %d", count);
-    
-    float I;//The total light intensity for any given polygon
-    quickSort(polygons,0,count);//Sort the polygons by distance from the camera
+#ifdef _WIN32
+//Module Name: present
+//Purpose: Copies the part of the rendered framebuffer that the window needs repainted in a single blit
+//Parameters hdc: the device context to draw on, fb: the rendered framebuffer, dirty: the invalidated rectangle of the window
+void present(HDC hdc, framebuffer_t *fb, RECT *dirty) {
+    BITMAPINFO bmi;
+    int left = max(dirty->left, 0), right = min(dirty->right, fb->w);
+    int top = max(dirty->top, 0), bottom = min(dirty->bottom, fb->h);
 
-    for(int i = 0; i < count; i++){
-        I = polygons[i].Id + Ia * Pa + polygons[i].Is;//Add up the three different types of light to get the total light intensity.
-        XFillConvexPolygon(hdc, RGB((int)polygons[i].RED* I,(int)polygons[i].GREEN*I,(int)polygons[i].BLUE* I), polygons[i].camera_points, 4); //fill the polys, using thier I value to determine the intensity of the colour
-    }
-    
+    if (left >= right || top >= bottom) return;
+
+    ZeroMemory(&bmi, sizeof(bmi));
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = fb->w;
+    bmi.bmiHeader.biHeight = -(bottom - top); //Negative height, the band of dirty rows is stored top row first
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    SetDIBitsToDevice(hdc, left, top, right - left, bottom - top, left, 0, 0, bottom - top, fb->pixels + top * fb->w, &bmi, DIB_RGB_COLORS);
 }
+
 //Module Name: WndProc
 //Author: http://www.winprog.org/tutorial/simple_window.html added upon by Zachary Kucera
 //Date: Jan 15th, 2019
@@ -352,7 +902,17 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
     {
 		case WM_PAINT: //When a WM_PAINT message is recieved, begin paint, draw the shape, and end paint.
             hdc = BeginPaint(hwnd, &ps);
-            draw();
+            {
+                size_t mark = dmat_arena_mark();
+
+                PROF_FRAME_BEGIN();
+                draw(&framebuffer);//Only renders if something has changed since the last frame
+                PROF_BEGIN(PROF_PRESENT);
+                present(hdc, &framebuffer, &ps.rcPaint);
+                PROF_END(PROF_PRESENT);
+                PROF_FRAME_END();
+                dmat_arena_release(mark);
+            }
             EndPaint(hwnd, &ps);
         break;
 
@@ -373,13 +933,50 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 }
 
 
+#ifndef NO_MAIN //Tools such as benchmark.c include this file for the renderer and bring their own main
 //Module Name: WinMain
 //Author: http://www.winprog.org/tutorial/simple_window.html 
 //Date: Jan 15th, 2019
-//Purpose: Main window function, opens the window and sends messages.
+//Purpose: Main window function, opens the window and sends messages. The command line takes the options of the headless main that are about drawing the scene, in any order and combination,
+//         such as -scene file to draw the scene in the file, sizing the window to it, and -profile text|json|csv to report every frame to stderr. It is split up the way the C runtime splits argv, by CommandLineToArgvW (link with shell32).
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     LPSTR lpCmdLine, int nCmdShow)
 {
+    struct options o;
+    int argc, parsed;
+    LPWSTR *wide = CommandLineToArgvW(GetCommandLineW(), &argc);
+    char **argv = wide ? (char **)calloc(argc + 1, sizeof(char *)) : NULL;
+
+    if (!argv) {
+        MessageBox(NULL, "Could not read the command line", "Error!", MB_ICONEXCLAMATION | MB_OK);
+        return 0;
+    }
+    for (int i = 0; i < argc; i++){//Back to the ANSI code page, which is what fopen takes the scene file name in
+        int size = WideCharToMultiByte(CP_ACP, 0, wide[i], -1, NULL, 0, NULL, NULL);
+
+        argv[i] = (char *)malloc(size > 0 ? size : 1);
+        if (!argv[i]) error("Could not allocate the command line");
+        argv[i][0] = '\0';
+        if (size > 0) WideCharToMultiByte(CP_ACP, 0, wide[i], -1, argv[i], size, NULL, NULL);
+    }
+    LocalFree(wide);
+
+    parsed = parseOptions(argc, argv, &o);//The scene keeps no pointers into argv, so it can go straight after
+    if (parsed && o.headless) {
+        snprintf(o.error, sizeof(o.error), "%s is only taken by the headless build", o.headless);
+        parsed = 0;
+    }
+    for (int i = 0; i < argc; i++) free(argv[i]);
+    free(argv);
+    if (!parsed) {
+        MessageBox(NULL, o.error, "Error!", MB_ICONEXCLAMATION | MB_OK);
+        return 0;
+    }
+    fb_alloc(&framebuffer, camera.w, camera.h); //Allocate the framebuffer before the first WM_PAINT arrives
+    dmat_arena_init(&frameArena, FRAME_ARENA_SIZE);
+    dmat_arena = &frameArena;
+    workers_start(o.threads); //One worker per core for tessellation, unless -threads says otherwise
+
     //Step 1: Registering the Window Class
     wc.cbSize        = sizeof(WNDCLASSEX);
     wc.style         = 0;
@@ -407,7 +1004,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
         g_szClassName,
         "Computer Graphics Assignment 3",
         WS_OVERLAPPEDWINDOW,
-        CW_USEDEFAULT, CW_USEDEFAULT, 512, 512, // Set the size of the window to 512 x 512
+        CW_USEDEFAULT, CW_USEDEFAULT, camera.w, camera.h, // Set the size of the window to that of the image
         NULL, NULL, hInstance, NULL);
 
     if(hwnd == NULL)
@@ -428,4 +1025,359 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     }
     return Msg.wParam;
 }
+#endif
+#else
+//Module Name: repaint
+//Purpose: Does what WM_PAINT does, without a window: draws the frame if anything has changed, then copies only the dirty rectangle to the window
+//Parameters window: stands in for the window, x0,y0,x1,y1: the dirty rectangle [x0,x1) x [y0,y1)
+//Returns 1 if the frame had to be rendered
+int repaint(framebuffer_t *window, int x0, int y0, int x1, int y1){
+    size_t mark = dmat_arena_mark();
+
+    PROF_FRAME_BEGIN();
+    int rendered = draw(&framebuffer);
+
+    PROF_BEGIN(PROF_PRESENT);
+    fb_copy_rect(window, &framebuffer, x0, y0, x1, y1);
+    PROF_END(PROF_PRESENT);
+    PROF_FRAME_END();
+    dmat_arena_release(mark);//Everything the frame allocated through matrix.h goes at once
+    return rendered;
+}
+
+//Module Name: framePattern
+//Purpose: Turns the output image name into a printf pattern for numbered frames. A name with a %d, such as frame%04d.ppm, is used as it is, any other gets _%04d before its extension.
+//Parameters filename: the output image name, pattern: receives the pattern, size: the room in pattern
+//Returns 0 if the name holds a % that is not a single %d conversion
+int framePattern(const char *filename, char *pattern, size_t size){
+    const char *percent = strchr(filename, '%');
+    const char *dot = strrchr(filename, '.');
+    const char *slash = strrchr(filename, '/');
+
+    if (percent) {
+        const char *c = percent + 1;
+
+        while (*c >= '0' && *c <= '9') c++;
+        if (*c != 'd' || strchr(c, '%')) return 0;//Anything else would hand printf an argument it does not have
+        snprintf(pattern, size, "%s", filename);
+        return 1;
+    }
+    if (!dot || (slash && dot < slash)) dot = filename + strlen(filename);
+    snprintf(pattern, size, "%.*s_%%04d%s", (int)(dot - filename), filename, dot);
+    return 1;
+}
+
+//Module Name: pathTessellation
+//Purpose: With level of detail on, picks the steps of every shape once for a whole camera path, the finest any of its frames needs, then turns the level of detail off so the meshes are built once and kept
+//Parameters path: the cameras
+void pathTessellation(camera_path_t *path){
+    static scene_t view;
+    int steps[SCENE_MAX_SHAPES][2] = { { 0 } };
+
+    view = scene;
+    for (int i = 0; i < path->frames; i++){
+        view.E = path->E[i];
+        view.G = path->G[i];
+        chooseTessellation(&view);
+        for (int j = 0; j < view.shapes; j++){
+            for (int k = 0; k < 2; k++){
+                if (view.shape[j].steps[k] > steps[j][k]) steps[j][k] = view.shape[j].steps[k];
+            }
+        }
+    }
+    for (int j = 0; j < scene.shapes; j++){
+        scene.shape[j].steps[0] = steps[j][0];
+        scene.shape[j].steps[1] = steps[j][1];
+    }
+    lodError = 0.0;
+}
+
+#ifndef NO_THREADS
+#define PIPELINE_FRAMES 2 //Polygon buffers in flight, one prepared by the geometry stage while the raster stage fills the other
+
+//A frame on its way through the pipeline
+struct pipelineFrame {
+    polygon_buffer_t polygons;      //Projected, lit and ordered by the geometry stage
+    int rejected[CULL_REASONS];     //How many polygons were culled for each reason
+};
+
+//The two stages of batch rendering and the queues between them
+struct pipeline {
+    camera_path_t *path;
+    struct pipelineFrame frames[PIPELINE_FRAMES];
+    work_queue_t empty;     //Frames the raster stage is done with
+    work_queue_t ready;     //Frames the geometry stage has prepared, in path order
+    double geometry;        //Seconds the geometry stage was busy
+    worker_pool_t workers;  //The geometry stage's share of the worker threads, the raster stage keeps the rest in worker_pool
+};
+
+//Module Name: geometryStage
+//Purpose: The first stage of the pipeline, run on a thread of its own. For every camera of the path it takes an empty frame, projects, lights and orders the polygons into it, and hands it to the raster stage.
+//         Only this thread touches the scene, the meshes and the matrix arena while the pipeline runs. Its jobs go to the pipeline's own pool.
+//Parameters arg: the pipeline
+void *geometryStage(void *arg){
+    struct pipeline *p = (struct pipeline *)arg;
+
+    workers_use(&p->workers);
+
+    for (int i = 0; i < p->path->frames; i++){
+        struct pipelineFrame *frame = (struct pipelineFrame *)queue_pop(&p->empty);
+        size_t mark = dmat_arena_mark();
+        double t = prof_now();
+        int rebuilt;
+
+        scene.E = p->path->E[i];
+        scene.G = p->path->G[i];
+        mesh_t *meshes = buildMeshes(&rebuilt);//Built for the first frame, kept after
+        shadeScene(meshes, &frame->polygons);
+        orderScene(&frame->polygons, frame->rejected);
+        p->geometry += prof_now() - t;
+        dmat_arena_release(mark);
+        queue_push(&p->ready, frame);
+    }
+    return NULL;
+}
+
+//Module Name: renderPathPipelined
+//Purpose: Batch mode with the geometry of frame N+1 prepared on another thread while frame N is filled into the framebuffer and written out, so a frame takes about the longer of the two stages instead of their sum.
+//         The frames go round two polygon buffers through a pair of bounded queues. The worker threads are split between the stages, half to each, so neither waits for the other's jobs.
+//Parameters path: the cameras, pattern: the image file name, with a %d for the frame number
+//Returns 0 if an image could not be written
+int renderPathPipelined(camera_path_t *path, const char *pattern){
+    static struct pipeline p;
+    pthread_t geometry;
+    char name[1024];
+    double start = prof_now(), raster = 0.0, total;
+    int written = 1, threads = worker_pool.n;
+
+    p.path = path;
+    p.geometry = 0.0;
+    p.workers.n = 1;
+    workers_stop();
+    workers_start(threads - threads / 2);
+    pool_start(&p.workers, threads / 2);
+    queue_init(&p.empty, PIPELINE_FRAMES);
+    queue_init(&p.ready, PIPELINE_FRAMES);
+    for (int k = 0; k < PIPELINE_FRAMES; k++) queue_push(&p.empty, &p.frames[k]);
+    stage_start(&geometry, geometryStage, &p);
+
+    for (int i = 0; i < path->frames; i++){
+        struct pipelineFrame *frame = (struct pipelineFrame *)queue_pop(&p.ready);
+        double t = prof_now();
+
+        if (written) {//After a failed write the frames are only drained, so the geometry stage can finish
+            fillScene(&framebuffer, &frame->polygons, frame->rejected);
+        }
+        queue_push(&p.empty, frame);//The polygons are done with, the next frame can be prepared while this one is written
+        if (written) {
+            snprintf(name, sizeof(name), pattern, i);
+            if (!fb_write_ppm(&framebuffer, name)) {
+                fprintf(stderr, "Could not write %s\n", name);
+                written = 0;
+            }
+        }
+        raster += prof_now() - t;
+    }
+    pthread_join(geometry, NULL);
+    pool_stop(&p.workers);
+    workers_stop();
+    workers_start(threads);
+    queue_destroy(&p.empty);
+    queue_destroy(&p.ready);
+    if (!written) return 0;
+
+    total = prof_now() - start;
+    fprintf(stderr, "%d frames in %.3f s, %.2f frames per second, pipelined: geometry %.3f ms and raster %.3f ms per frame\n",
+            path->frames, total, path->frames / total, 1000.0 * p.geometry / path->frames, 1000.0 * raster / path->frames);
+    return 1;
+}
+#endif
+
+//Module Name: renderPath
+//Purpose: Batch mode. Renders the scene from every camera of a path and writes each frame out as a numbered PPM image, then reports the frames per second to stderr.
+//         The world-space meshes are built for the first frame and kept, so every later frame only rebuilds the camera matrix, then re-projects, re-lights and re-fills the polygons.
+//Parameters path: the cameras, pattern: the image file name, with a %d for the frame number, see framePattern, pipelined: 1 to overlap the geometry of one frame with the fill of the last, see renderPathPipelined
+//Returns 0 if an image could not be written
+int renderPath(camera_path_t *path, const char *pattern, int pipelined){
+    char name[1024];
+    double start = prof_now(), drawing = 0.0, total;
+
+    if (lodError > 0.0) pathTessellation(path);
+#ifndef NO_THREADS
+    if (pipelined) return renderPathPipelined(path, pattern);
+#endif
+    for (int i = 0; i < path->frames; i++){
+        size_t mark = dmat_arena_mark();
+        double t = prof_now();
+
+        scene.E = path->E[i];
+        scene.G = path->G[i];
+        PROF_FRAME_BEGIN();
+        draw(&framebuffer);
+        PROF_FRAME_END();
+        dmat_arena_release(mark);
+        drawing += prof_now() - t;
 
+        snprintf(name, sizeof(name), pattern, i);
+        if (!fb_write_ppm(&framebuffer, name)) {
+            fprintf(stderr, "Could not write %s\n", name);
+            return 0;
+        }
+    }
+    total = prof_now() - start;
+    fprintf(stderr, "%d frames in %.3f s, %.2f frames per second, %.2f drawing alone\n", path->frames, total, path->frames / total, path->frames / drawing);
+    return 1;
+}
+
+//Module Name: compareReference
+//Purpose: Checks a rendered frame against a reference image, such as those in scenes/golden, and reports the differences to stderr.
+//         The frame passes when no more than maxPixels pixels have a channel more than tolerance off and the PSNR is at least minPsnr. On failure an image of the differences is written, see fb_compare.
+//Parameters fb: the rendered frame, reference: the reference PPM, tolerance/maxPixels/minPsnr: what counts as a pass, diffFile: where the difference image goes
+//Returns 1 if the frame passes, 0 if it does not or the reference cannot be read
+int compareReference(framebuffer_t *fb, const char *reference, int tolerance, long maxPixels, double minPsnr, const char *diffFile){
+    framebuffer_t ref, diff;
+    fb_diff_t r;
+    int pass;
+
+    if (!fb_read_ppm(&ref, reference)) {
+        fprintf(stderr, "Could not read %s as a binary PPM\n", reference);
+        return 0;
+    }
+    if (ref.w != fb->w || ref.h != fb->h) {
+        fprintf(stderr, "%s is %dx%d, the frame is %dx%d\n", reference, ref.w, ref.h, fb->w, fb->h);
+        fb_free(&ref);
+        return 0;
+    }
+    fb_alloc(&diff, fb->w, fb->h);
+    fb_compare(fb, &ref, tolerance, &diff, &r);
+    pass = r.pixels <= maxPixels && r.psnr >= minPsnr;
+
+    if (r.psnr == DBL_MAX) fprintf(stderr, "%s: identical\n", reference);
+    else fprintf(stderr, "%s: %ld pixels off by more than %d, largest difference %d, PSNR %.2f dB: %s\n", reference, r.pixels, tolerance, r.max_diff, r.psnr, pass ? "pass" : "FAIL");
+    if (!pass) {
+        if (fb_write_ppm(&diff, diffFile)) fprintf(stderr, "Differences written to %s\n", diffFile);
+        else fprintf(stderr, "Could not write %s\n", diffFile);
+    }
+    fb_free(&diff);
+    fb_free(&ref);
+    return pass;
+}
+
+#ifndef NO_MAIN
+//Module Name: main
+//Purpose: Headless entry point for systems without Win32. Renders one frame into the framebuffer and writes it out as a PPM image, or a camera path into numbered images.
+//         A single frame can also be checked against a reference image, which is how a faster filler, visibility mode or tessellation is held to the picture of the original one.
+//         Build with: cc -O2 -o assignment3 zkucera_CompSci_Assignment3.c -lm -lpthread
+//Parameters argv: [-scene file] [-fill span|scanline] [-visibility painter|zbuffer] [-threads n] [-tiles size] [-repaint n] [-cull on|off] [-shading flat|gouraud] [-coarsen f] [-lod error] [-lod-min n] [-lod-max n] [-orbit n] [-orbit-degrees d] [-path file] [-pipeline on|off] [-compare reference] [-tolerance n] [-max-pixels n] [-psnr db] [-diff file] [-profile off|text|json|csv] [output image], the image defaults to render.ppm and the thread count to the number of cores.
+//         -scene draws the camera, lights and shapes described in the file, see scene.c, instead of the built-in scene, at the image size it gives
+//         -repaint issues n more repaint requests after the first frame, each for a 64x64 dirty rectangle moving across the window, and reports the time per repaint
+//         -cull off lights, sorts and fills every polygon, including back faces and those outside the view
+//         -shading gouraud lights the mesh vertices and blends their colours across the polygons, which stays smooth with a coarser tessellation
+//         -coarsen divides the number of parametric steps of every shape by f, so f > 1 draws fewer, larger polygons
+//         -lod picks the steps from the size of each shape on screen instead, so no edge strays more than error pixels from the surface, with lod-min to lod-max steps along each parameter
+//         -orbit renders n frames turning the eye about the up direction through the gaze point, d degrees (360 by default) in all, instead of the one frame
+//         -path renders a frame for each line of the file instead, the eye x y z and optionally the gaze point x y z, see camera_path_load
+//         With either, the output image name is numbered per frame, see framePattern, and -repaint is ignored
+//         -pipeline on prepares the polygons of each frame of the path on a second thread while the frame before is filled and written, instead of one after the other. It reports no per-frame profile.
+//         -compare checks the frame against the reference PPM and exits with 1 if it fails, see compareReference. A pixel is off when a channel differs by more than -tolerance (0 by default),
+//         and the frame fails with more than -max-pixels such pixels (0 by default) or a PSNR under -psnr dB (no limit by default). The differences are then written to -diff, by default the image name with _diff added.
+//         scenes/golden holds canonical scenes, each with a reference image drawn with the settings that match the original renderer, which the default settings match exactly. scenes/golden/check.sh renders every one of them
+//         at the tolerance its scene file records and exits with 1 if any fails. Options given to it are passed on, so a mode that draws differently is held to the references with a looser tolerance, e.g.
+//         scenes/golden/check.sh ./assignment3 -visibility zbuffer -tolerance 8 -max-pixels 200 -psnr 45
+//         -profile reports the stage times and counters of every repaint to stderr, as text or one JSON object or CSV row per frame. Build with -DNO_PROFILE to compile the profiler out.
+int main(int argc, char *argv[])
+{
+    camera_path_t path = { 0 };
+    struct options o;
+
+    if (!parseOptions(argc, argv, &o)) {
+        fprintf(stderr, "%s\n", o.error);
+        return 1;
+    }
+#ifdef NO_THREADS
+    if (o.pipelined) {
+        fprintf(stderr, "-pipeline on needs a build without NO_THREADS\n");
+        return 1;
+    }
+#endif
+    if (o.pipelined && o.profiling) {
+        fprintf(stderr, "-pipeline on overlaps the frames, so it cannot be used with -profile\n");
+        return 1;
+    }
+    if (o.pathFile && o.orbitFrames > 0) {
+        fprintf(stderr, "Give either -orbit or -path, not both\n");
+        return 1;
+    }
+    if (o.reference && (o.pathFile || o.orbitFrames > 0)) {
+        fprintf(stderr, "-compare checks a single frame, it cannot be used with -orbit or -path\n");
+        return 1;
+    }
+    if (o.pathFile && !camera_path_load(&path, &scene, o.pathFile)) return 1;
+    if (o.orbitFrames > 0) camera_path_orbit(&path, &scene, o.orbitFrames, o.orbitDegrees);
+    workers_start(o.threads);
+
+    fb_alloc(&framebuffer, camera.w, camera.h);
+    dmat_arena_init(&frameArena, FRAME_ARENA_SIZE);
+    dmat_arena = &frameArena;
+
+    if (path.frames > 0) {
+        char pattern[1024];
+        int written;
+
+        if (!framePattern(o.filename, pattern, sizeof(pattern))) {
+            fprintf(stderr, "The image name %s may only hold one %%d, for the frame number\n", o.filename);
+            return 1;
+        }
+        written = renderPath(&path, pattern, o.pipelined);
+        camera_path_free(&path);
+        fb_free(&framebuffer);
+        dmat_arena_free(&frameArena);
+        workers_stop();
+        return written ? 0 : 1;
+    }
+
+    framebuffer_t window;//Stands in for the window the frames are presented to
+    int rendered = 0;
+
+    fb_alloc(&window, camera.w, camera.h);
+    repaint(&window, 0, 0, camera.w, camera.h);//The first WM_PAINT covers the whole window
+    printf("\n");
+
+    if (o.repaints > 0) {
+        double start = prof_now();
+
+        for (int i = 0; i < o.repaints; i++){
+            int x0 = (i * 64) % camera.w, y0 = ((i * 64) / camera.w * 64) % camera.h;
+
+            rendered += repaint(&window, x0, y0, x0 + 64, y0 + 64);
+        }
+        fprintf(stderr, "%d repaints, %d re-rendered, %.4f ms per repaint\n", o.repaints, rendered, 1000.0 * (prof_now() - start) / o.repaints);
+    }
+    fb_free(&window);
+
+    if (!fb_write_ppm(&framebuffer, o.filename)) {
+        fprintf(stderr, "Could not write %s\n", o.filename);
+        return 1;
+    }
+
+    int pass = 1;
+
+    if (o.reference) {
+        char name[1024];
+
+        if (!o.diffFile) {//The image name with _diff before its extension
+            const char *dot = strrchr(o.filename, '.'), *slash = strrchr(o.filename, '/');
+
+            if (!dot || (slash && dot < slash)) dot = o.filename + strlen(o.filename);
+            snprintf(name, sizeof(name), "%.*s_diff%s", (int)(dot - o.filename), o.filename, dot);
+            o.diffFile = name;
+        }
+        pass = compareReference(&framebuffer, o.reference, o.tolerance, o.maxPixels, o.minPsnr, o.diffFile);
+    }
+    fb_free(&framebuffer);
+    dmat_arena_free(&frameArena);
+    workers_stop();
+    return pass ? 0 : 1;
+}
+#endif
+#endif